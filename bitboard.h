@@ -0,0 +1,270 @@
+#ifndef BITBOARD_H
+#define BITBOARD_H
+
+#include <cstdint>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+// Bitboards -- one bit per square. Squares are numbered the same way as Position (file + 8 * rank) so a1 is bit 0 and h8 is bit 63.
+
+namespace Bitboards {
+
+inline int square(int file, int rank) { return file + 8 * rank; }
+inline uint64_t bit(int sq) { return 1ULL << sq; }
+
+inline int popcount(uint64_t b) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(b);
+#else
+    int res = 0;
+    while (b) { b &= b - 1; res++; }
+    return res;
+#endif
+}
+
+// Index of the lowest set bit. b must not be empty.
+inline int lsb(uint64_t b) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(b);
+#else
+    int res = 0;
+    while (!(b & 1)) { b >>= 1; res++; }
+    return res;
+#endif
+}
+
+// Removes the lowest set bit and returns its index.
+inline int poplsb(uint64_t& b) {
+    int res = lsb(b);
+    b &= b - 1;
+    return res;
+}
+
+// Precomputed attack sets for the non-sliding pieces. Built once on first use.
+struct LeaperTables {
+    uint64_t pawn[2][64]; // [WHITE, BLACK] -- squares a pawn on the given square attacks
+    uint64_t knight[64];
+    uint64_t king[64];
+
+    LeaperTables() {
+        int ndx[8] = {02, 01, -1, -2, -2, -1, 01, 02};
+        int ndy[8] = {01, 02, 02, 01, -1, -2, -2, -1};
+        int kdx[8] = {00, 01, 01, 01, 00, -1, -1, -1};
+        int kdy[8] = {01, 01, 00, -1, -1, -1, 00, 01};
+
+        for (int sq = 0; sq < 64; sq++) {
+            int x = sq % 8;
+            int y = sq / 8;
+            pawn[0][sq] = pawn[1][sq] = knight[sq] = king[sq] = 0;
+
+            for (int i = 0; i < 8; i++) {
+                if (x + ndx[i] >= 0 && x + ndx[i] < 8 && y + ndy[i] >= 0 && y + ndy[i] < 8) knight[sq] |= bit(square(x + ndx[i], y + ndy[i]));
+                if (x + kdx[i] >= 0 && x + kdx[i] < 8 && y + kdy[i] >= 0 && y + kdy[i] < 8) king[sq] |= bit(square(x + kdx[i], y + kdy[i]));
+            }
+
+            for (int dx = -1; dx <= 1; dx += 2) {
+                if (x + dx < 0 || x + dx > 7) continue;
+                if (y < 7) pawn[0][sq] |= bit(square(x + dx, y + 1));
+                if (y > 0) pawn[1][sq] |= bit(square(x + dx, y - 1));
+            }
+        }
+    }
+};
+
+inline const LeaperTables& leapers() {
+    static const LeaperTables tables;
+    return tables;
+}
+
+// color is 0 for WHITE and 1 for BLACK (same as the color bits of ChessPiece)
+inline uint64_t pawnAttacks(int color, int sq) { return leapers().pawn[color][sq]; }
+inline uint64_t knightAttacks(int sq) { return leapers().knight[sq]; }
+inline uint64_t kingAttacks(int sq) { return leapers().king[sq]; }
+
+// Walks a ray from sq until it leaves the board or hits an occupied square (which is included).
+inline uint64_t rayAttacks(int sq, uint64_t occ, int dx, int dy) {
+    uint64_t res = 0;
+    int x = sq % 8 + dx;
+    int y = sq / 8 + dy;
+    while (x >= 0 && x < 8 && y >= 0 && y < 8) {
+        res |= bit(square(x, y));
+        if (occ & bit(square(x, y))) break;
+        x += dx;
+        y += dy;
+    }
+    return res;
+}
+
+// Sliding attacks are looked up from precomputed tables. Each square has a mask of the squares that can block it (board edges excluded).
+// The occupancy under that mask is hashed into a dense index either with PEXT (when the compiler targets BMI2) or with a magic multiply.
+
+struct Magic {
+    uint64_t mask;
+    uint64_t magic;
+    uint64_t* attacks;
+    int shift;
+
+    unsigned index(uint64_t occ) const {
+#if defined(__BMI2__)
+        return (unsigned)_pext_u64(occ, mask);
+#else
+        return (unsigned)(((occ & mask) * magic) >> shift);
+#endif
+    }
+};
+
+struct SliderTables {
+    Magic bishop[64];
+    Magic rook[64];
+    uint64_t bishopTable[5248];
+    uint64_t rookTable[102400];
+
+    SliderTables() {
+        int bdx[4] = {01, 01, -1, -1};
+        int bdy[4] = {01, -1, 01, -1};
+        int rdx[4] = {00, 01, 00, -1};
+        int rdy[4] = {01, 00, -1, 00};
+        init(bishop, bishopTable, bdx, bdy);
+        init(rook, rookTable, rdx, rdy);
+    }
+
+    static uint64_t slide(int sq, uint64_t occ, int dx[4], int dy[4]) {
+        uint64_t res = 0;
+        for (int i = 0; i < 4; i++) res |= rayAttacks(sq, occ, dx[i], dy[i]);
+        return res;
+    }
+
+    // Blocker mask -- the ray squares minus the last one in each direction, since a piece on the edge never blocks anything further.
+    static uint64_t blockers(int sq, int dx[4], int dy[4]) {
+        uint64_t res = 0;
+        for (int i = 0; i < 4; i++) {
+            int x = sq % 8 + dx[i];
+            int y = sq / 8 + dy[i];
+            while (x + dx[i] >= 0 && x + dx[i] < 8 && y + dy[i] >= 0 && y + dy[i] < 8) {
+                res |= bit(square(x, y));
+                x += dx[i];
+                y += dy[i];
+            }
+        }
+        return res;
+    }
+
+    static void init(Magic* magics, uint64_t* table, int dx[4], int dy[4]) {
+        uint64_t occs[4096];
+        uint64_t refs[4096];
+        int epoch[4096] = {0};
+        int attempt = 0;
+        uint64_t seeds[8] = {728, 10316, 55013, 32803, 12281, 15100, 16645, 255}; // Seeds (one per rank, restarted on every square) that find magics quickly
+        uint64_t seed = 0;
+
+        for (int sq = 0; sq < 64; sq++) {
+            Magic& m = magics[sq];
+            seed = seeds[sq / 8];
+            m.mask = blockers(sq, dx, dy);
+            m.shift = 64 - popcount(m.mask);
+            m.attacks = table;
+
+            // Enumerate every subset of the mask (Carry-Rippler) along with its attack set.
+            int size = 0;
+            uint64_t occ = 0;
+            do {
+                occs[size] = occ;
+                refs[size] = slide(sq, occ, dx, dy);
+                size++;
+                occ = (occ - m.mask) & m.mask;
+            } while (occ);
+            table += size;
+
+#if defined(__BMI2__)
+            m.magic = 0;
+            for (int i = 0; i < size; i++) m.attacks[m.index(occs[i])] = refs[i];
+#else
+            // Try sparse random numbers until one maps every subset without a destructive collision.
+            while (true) {
+                do {
+                    m.magic = random(seed) & random(seed) & random(seed);
+                } while (popcount((m.mask * m.magic) >> 56) < 6);
+
+                attempt++;
+                bool ok = true;
+                for (int i = 0; i < size && ok; i++) {
+                    unsigned idx = m.index(occs[i]);
+                    if (epoch[idx] < attempt) {
+                        epoch[idx] = attempt;
+                        m.attacks[idx] = refs[i];
+                    }
+                    else if (m.attacks[idx] != refs[i]) ok = false;
+                }
+                if (ok) break;
+            }
+#endif
+        }
+    }
+
+    static uint64_t random(uint64_t& s) { // xorshift64*
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return s * 2685821657736338717ULL;
+    }
+};
+
+inline const SliderTables& sliders() {
+    static const SliderTables tables;
+    return tables;
+}
+
+inline uint64_t bishopAttacks(int sq, uint64_t occ) {
+    const Magic& m = sliders().bishop[sq];
+    return m.attacks[m.index(occ)];
+}
+
+inline uint64_t rookAttacks(int sq, uint64_t occ) {
+    const Magic& m = sliders().rook[sq];
+    return m.attacks[m.index(occ)];
+}
+
+inline uint64_t queenAttacks(int sq, uint64_t occ) {
+    return bishopAttacks(sq, occ) | rookAttacks(sq, occ);
+}
+
+// Squares strictly between two squares on a shared rank, file or diagonal, and the whole line through them (0 if not aligned).
+struct LineTables {
+    uint64_t between[64][64];
+    uint64_t line[64][64];
+
+    LineTables() {
+        int dx[8] = {00, 01, 01, 01, 00, -1, -1, -1};
+        int dy[8] = {01, 01, 00, -1, -1, -1, 00, 01};
+        for (int a = 0; a < 64; a++) {
+            for (int b = 0; b < 64; b++) between[a][b] = line[a][b] = 0;
+            for (int i = 0; i < 8; i++) {
+                uint64_t full = bit(a) | rayAttacks(a, 0, dx[i], dy[i]) | rayAttacks(a, 0, -dx[i], -dy[i]);
+                uint64_t walked = 0;
+                int x = a % 8 + dx[i];
+                int y = a / 8 + dy[i];
+                while (x >= 0 && x < 8 && y >= 0 && y < 8) {
+                    between[a][square(x, y)] = walked;
+                    line[a][square(x, y)] = full;
+                    walked |= bit(square(x, y));
+                    x += dx[i];
+                    y += dy[i];
+                }
+            }
+        }
+    }
+};
+
+inline const LineTables& lines() {
+    static const LineTables tables;
+    return tables;
+}
+
+inline uint64_t between(int a, int b) { return lines().between[a][b]; }
+inline uint64_t line(int a, int b) { return lines().line[a][b]; }
+
+}
+
+#endif
@@ -4,14 +4,19 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <sstream>
 #include <set>
 #include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include "bitboard.h"
+#include "zobrist.h"
 
 struct ChessPiece {
     char value;
     
     // WHITE BLACK ... PAWN KNIGHT BISHOP ROOK QUEEN KING
-    char ids[8] = {'_', '*', 'P', 'N', 'B', 'R', 'Q', 'K'};
+    static char symbol(int i) { return "_*PNBRQK"[i]; }
     
     ChessPiece() {
         value = 0;
@@ -21,10 +26,6 @@ struct ChessPiece {
         value = c;
     }
     
-    ChessPiece(const ChessPiece& other) {
-        value = other.value;
-    }
-    
     bool isWhite() { return (value & (1<<0)); }
     bool isBlack() { return (value & (1<<1)); }
     bool isPawn() { return (value & (1<<2)); }
@@ -34,11 +35,9 @@ struct ChessPiece {
     bool isQueen() { return (value & (1<<6)); }
     bool isKing() { return (value & (1<<7)); }
     
-    int getID() {
-        for (int i = 2; i < 8; i++) {
-            if (value & (1<<i)) return i;
-        }
-        return 0;
+    int getID() { // Lowest piece bit (2 PAWN ... 7 KING), 0 if empty
+        unsigned char type = value & 0xFC;
+        return type ? Bitboards::lsb(type) : 0;
     }
     
     bool getColor() { // deal with it
@@ -57,7 +56,7 @@ struct ChessPiece {
         if (value == 0) return "..";
         std::string res = "";
         for (int i = 0; i < 8; i++) {
-            if (value & (1<<i)) res = res + ids[i];
+            if (value & (1<<i)) res = res + symbol(i);
         }
         if (res.length() > 2) res = res.substr(0, 2);
         while (res.length() < 2) res = res + "~";
@@ -69,6 +68,10 @@ struct ChessPiece {
     bool operator!=(ChessPiece& other) { return value != other.value; }
 };
 
+// A board is 64 of these so keep them to a byte and cheap to copy.
+static_assert(sizeof(ChessPiece) == 1, "ChessPiece must stay one byte");
+static_assert(std::is_trivially_copyable<ChessPiece>::value, "ChessPiece must stay trivially copyable");
+
 struct Position {
     // Grid cells are represented as chars -- lower 3 bits file, upper 3 bits rank.
     char value = -1;
@@ -119,6 +122,60 @@ struct Position {
     bool operator!=(Position& other) { return value != other.value; }
 };
 
+// A move packed into 16 bits -- bits 0-5 source square, bits 6-11 destination square (file + 8 * rank), bits 12-15 flag.
+// Flags: 0 normal, 1 double pawn push, 2 castle, 3 en passant, 4-7 promote to KNIGHT BISHOP ROOK QUEEN.
+struct Move {
+    uint16_t value = 0; // a1a1 is never a real move so 0 doubles as the null move
+    
+    Move() {
+        value = 0;
+    }
+    
+    Move(int from, int to, int flag = 0) {
+        value = from | (to << 6) | (flag << 12);
+    }
+    
+    int from() { return value & 63; }
+    int to() { return (value >> 6) & 63; }
+    int flag() { return value >> 12; }
+    
+    bool isNull() { return value == 0; }
+    bool isDoublePush() { return flag() == 1; }
+    bool isCastle() { return flag() == 2; }
+    bool isEnPassant() { return flag() == 3; }
+    bool isPromotion() { return flag() >= 4; }
+    int promotion() { return isPromotion() ? flag() - 1 : 0; } // Piece bit of the promoted piece (3 KNIGHT ... 6 QUEEN)
+    
+    // The (source, movement vector) form used by ChessGame
+    std::pair<int, int> src() { return {from() % 8, from() / 8}; }
+    std::pair<int, int> vec() { return {to() % 8 - from() % 8, to() / 8 - from() / 8}; }
+    
+    std::string toString() { // Long algebraic e.g. e2e4, e7e8q
+        if (isNull()) return "0000";
+        std::string res = Position(from() % 8, from() / 8).toString() + Position(to() % 8, to() / 8).toString();
+        if (isPromotion()) res = res + "nbrq"[flag() - 4];
+        return res;
+    }
+    
+    bool operator==(const Move& other) const { return value == other.value; }
+    bool operator!=(const Move& other) const { return value != other.value; }
+};
+
+// Fixed-capacity move buffer that lives on the stack. No legal position has more than 218 moves.
+struct MoveList {
+    Move moves[256];
+    int count = 0;
+    
+    void push(Move m) { moves[count++] = m; }
+    void clear() { count = 0; }
+    int size() { return count; }
+    bool empty() { return count == 0; }
+    
+    Move& operator[](int i) { return moves[i]; }
+    Move* begin() { return moves; }
+    Move* end() { return moves + count; }
+};
+
 struct ChessGame { // A chess game at some particular state
     // Side to move is a single bit -- true is WHITE
     bool sidetomove = true; // Slight misnomer - this value actually stores which side we are moving and analyzing. The turn formally changes when this value is rotated.
@@ -134,6 +191,32 @@ struct ChessGame { // A chess game at some particular state
     
     ChessPiece board[8][8];
     
+    // Bitboard mirror of the board. bitboards[i] has a bit set for every square whose piece has bit i set in its value,
+    // so [0] is all WHITE pieces, [1] is all BLACK pieces and [2] through [7] are the pawns through kings of both colors.
+    // Any write to board[][] must go through setPiece() (or be followed by syncBitboards()) to keep the two in step.
+    uint64_t bitboards[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    
+    // Zobrist hash of the pieces, castling rights and en passant files, kept up to date by setPiece() and execute().
+    // The side to move is left out because callers flip sidetomove directly -- use key() for the full position key.
+    uint64_t hash = 0;
+    
+    // What makes a pseudolegal move illegal for one side.
+    struct LegalMasks {
+        int ksq;
+        uint64_t checkers; // Enemy pieces giving check
+        uint64_t danger; // Squares the king may not step onto
+        uint64_t evasions; // Where other pieces must land -- on the checker or in its way. Everything when not in check, nothing in double check.
+        uint64_t pinned; // May only move along the line through their king
+    };
+    
+    // Attack maps of the current placement. Each part is worked out the first time something asks for it (move generation, check tests,
+    // castling, evaluation) and reused until setPiece() changes the board. The side to move, castling rights and en passant don't affect it.
+    struct AttackInfo {
+        uint64_t attacked[2]; // Every square attacked by WHITE, BLACK
+        LegalMasks masks[2]; // For WHITE, BLACK
+    };
+    AttackInfo attackinfo;
+    int attacksvalid = 0; // Bits 1, 2 -- attacked[WHITE, BLACK] is current. Bits 4, 8 -- masks[WHITE, BLACK] is current.
     
     ChessGame() {
         sidetomove = true;
@@ -145,6 +228,11 @@ struct ChessGame { // A chess game at some particular state
     }
     
     ChessGame(const ChessGame& other) {
+        *this = other;
+    }
+    
+    ChessGame& operator=(const ChessGame& other) {
+        if (this == &other) return *this;
         sidetomove = other.sidetomove;
         castleq = std::make_pair(other.castleq.first, other.castleq.second);
         castlek = std::make_pair(other.castlek.first, other.castlek.second);
@@ -152,16 +240,20 @@ struct ChessGame { // A chess game at some particular state
         halfmoveclock = other.halfmoveclock;
         maxmoves = other.maxmoves;
         
+        captures.clear();
         for (auto i : other.captures) captures.push_back(ChessPiece(i));
         
-        for (int x = 0; x < 8; x++) {
-            for (int y = 0; y < 8; y++) board[x][y] = ChessPiece(other.board[x][y]);
-        }
+        std::memcpy(board, other.board, sizeof(board));
+        std::memcpy(bitboards, other.bitboards, sizeof(bitboards));
+        hash = other.hash;
+        attackinfo = other.attackinfo;
+        attacksvalid = other.attacksvalid;
+        return *this;
     }
     
-    char backrank[8] = {(1<<5), (1<<3), (1<<4), (1<<6), (char)(128), (1<<4), (1<<3), (1<<5)};
-    
     void reset() {
+        static const char backrank[8] = {(1<<5), (1<<3), (1<<4), (1<<6), (char)(128), (1<<4), (1<<3), (1<<5)};
+        
         castleq = {true, true};
         castlek = {true, true};
         eps = {-1, -1};
@@ -177,6 +269,130 @@ struct ChessGame { // A chess game at some particular state
             board[x][1] = ChessPiece((1<<2) | (1<<0));
             board[x][6] = ChessPiece((1<<2) | (1<<1));
         }
+        
+        syncBitboards();
+    }
+    
+    // Bitboard maintenance
+    
+    void setPiece(int x, int y, ChessPiece piece) {
+        uint64_t b = Bitboards::bit(Bitboards::square(x, y));
+        unsigned char old = board[x][y].value;
+        unsigned char now = piece.value;
+        for (int i = 0; i < 8; i++) {
+            if (old & (1<<i)) bitboards[i] &= ~b;
+            if (now & (1<<i)) bitboards[i] |= b;
+        }
+        hash ^= Zobrist::piece(old, Bitboards::square(x, y)) ^ Zobrist::piece(now, Bitboards::square(x, y));
+        board[x][y] = piece;
+        attacksvalid = 0;
+    }
+    
+    void setPiece(std::pair<int, int> p, ChessPiece piece) {
+        setPiece(p.first, p.second, piece);
+    }
+    
+    // Rebuilds the bitboards and hash from scratch. Only needed if board[][], castleq/castlek or eps were written to directly.
+    void syncBitboards() {
+        for (int i = 0; i < 8; i++) bitboards[i] = 0;
+        for (int x = 0; x < 8; x++) {
+            for (int y = 0; y < 8; y++) {
+                unsigned char v = board[x][y].value;
+                for (int i = 0; i < 8; i++) if (v & (1<<i)) bitboards[i] |= Bitboards::bit(Bitboards::square(x, y));
+            }
+        }
+        hash = computeHash();
+        attacksvalid = 0;
+    }
+    
+    // Hash of the castling rights and en passant files
+    uint64_t stateHash() {
+        const Zobrist::Keys& k = Zobrist::keys();
+        uint64_t res = 0;
+        if (castleq.first) res ^= k.castle[0];
+        if (castlek.first) res ^= k.castle[1];
+        if (castleq.second) res ^= k.castle[2];
+        if (castlek.second) res ^= k.castle[3];
+        if (eps.first >= 0) res ^= k.ep[(int)eps.first];
+        if (eps.second >= 0) res ^= k.ep[8 + eps.second];
+        return res;
+    }
+    
+    uint64_t computeHash() {
+        uint64_t res = stateHash();
+        for (int sq = 0; sq < 64; sq++) res ^= Zobrist::piece(board[sq % 8][sq / 8].value, sq);
+        return res;
+    }
+    
+    // Full position key including the side to move
+    uint64_t key() {
+        return sidetomove ? hash : (hash ^ Zobrist::keys().side);
+    }
+    
+    // How many pieces of a color (0 WHITE, 1 BLACK) and type (piece bit, 2 PAWN ... 7 KING) are on the board.
+    // setPiece() keeps the bitboards current through execute() and unmakeMove() so this is a lookup, not a board scan.
+    int pieceCount(int color, int id) {
+        return Bitboards::popcount(bitboards[color] & bitboards[id]);
+    }
+    
+    // Squares holding exactly the given piece value, e.g. pieces((1<<0) | (1<<7)) is the white king(s).
+    uint64_t pieces(char value) {
+        uint64_t res = ~0ULL;
+        bool any = false;
+        for (int i = 0; i < 8; i++) {
+            if (value & (1<<i)) {
+                res &= bitboards[i];
+                any = true;
+            }
+        }
+        return any ? res : ~occupancy();
+    }
+    
+    uint64_t occupancy() {
+        return bitboards[0] | bitboards[1];
+    }
+    
+    // Is the square (file + 8 * rank) attacked by any piece of the given side?
+    bool isAttacked(int sq, bool byWhite) {
+        if (attacksvalid & (byWhite ? 1 : 2)) return attackinfo.attacked[byWhite ? 0 : 1] & Bitboards::bit(sq);
+        return attackersTo(sq, occupancy()) & bitboards[byWhite ? 0 : 1];
+    }
+    
+    // Every square one side attacks (cached)
+    uint64_t attacked(bool byWhite) {
+        int c = byWhite ? 0 : 1;
+        if (!(attacksvalid & (1 << c))) {
+            attackinfo.attacked[c] = attacksBy(byWhite, occupancy());
+            attacksvalid |= 1 << c;
+        }
+        return attackinfo.attacked[c];
+    }
+    
+    // Every piece of either color that attacks the square, with sliders blocked by the given occupancy.
+    uint64_t attackersTo(int sq, uint64_t occ) {
+        return (Bitboards::pawnAttacks(1, sq) & bitboards[0] & bitboards[2])
+             | (Bitboards::pawnAttacks(0, sq) & bitboards[1] & bitboards[2])
+             | (Bitboards::knightAttacks(sq) & bitboards[3])
+             | (Bitboards::kingAttacks(sq) & bitboards[7])
+             | (Bitboards::bishopAttacks(sq, occ) & (bitboards[4] | bitboards[6]))
+             | (Bitboards::rookAttacks(sq, occ) & (bitboards[5] | bitboards[6]));
+    }
+    
+    // Every square attacked by one side, with sliders blocked by the given occupancy.
+    uint64_t attacksBy(bool byWhite, uint64_t occ) {
+        int c = byWhite ? 0 : 1;
+        uint64_t res = 0;
+        uint64_t b = bitboards[c] & bitboards[2];
+        while (b) res |= Bitboards::pawnAttacks(c, Bitboards::poplsb(b));
+        b = bitboards[c] & bitboards[3];
+        while (b) res |= Bitboards::knightAttacks(Bitboards::poplsb(b));
+        b = bitboards[c] & (bitboards[4] | bitboards[6]);
+        while (b) res |= Bitboards::bishopAttacks(Bitboards::poplsb(b), occ);
+        b = bitboards[c] & (bitboards[5] | bitboards[6]);
+        while (b) res |= Bitboards::rookAttacks(Bitboards::poplsb(b), occ);
+        b = bitboards[c] & bitboards[7];
+        while (b) res |= Bitboards::kingAttacks(Bitboards::poplsb(b));
+        return res;
     }
     
     
@@ -194,6 +410,89 @@ struct ChessGame { // A chess game at some particular state
         return res;
     }
     
+    // Forsyth-Edwards notation e.g. "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1"
+    // The fullmove number is not tracked so it is always written as 1.
+    std::string toFEN() {
+        std::string res = "";
+        for (int y = 7; y >= 0; y--) {
+            int gap = 0;
+            for (int x = 0; x < 8; x++) {
+                ChessPiece piece = board[x][y];
+                if (piece.isEmpty()) {
+                    gap++;
+                    continue;
+                }
+                if (gap) res = res + std::to_string(gap);
+                gap = 0;
+                char c = "..pnbrqk"[piece.getID()];
+                res = res + (char)(piece.isWhite() ? c - 'a' + 'A' : c);
+            }
+            if (gap) res = res + std::to_string(gap);
+            if (y) res = res + "/";
+        }
+        
+        res = res + (sidetomove ? " w " : " b ");
+        std::string castling = "";
+        if (castlek.first) castling = castling + "K";
+        if (castleq.first) castling = castling + "Q";
+        if (castlek.second) castling = castling + "k";
+        if (castleq.second) castling = castling + "q";
+        res = res + (castling.empty() ? "-" : castling);
+        
+        if (eps.first >= 0) res = res + " " + (char)('a' + eps.first) + "3";
+        else if (eps.second >= 0) res = res + " " + (char)('a' + eps.second) + "6";
+        else res = res + " -";
+        
+        return res + " " + std::to_string(halfmoveclock) + " 1";
+    }
+    
+    // Sets up the game from Forsyth-Edwards notation. The clocks are optional. Returns false (leaving the game untouched) if the string could not be read.
+    bool fromFEN(std::string fen) {
+        std::istringstream in(fen);
+        std::string placement, side, castling, ep;
+        int halfmove = 0;
+        if (!(in >> placement >> side >> castling >> ep)) return false;
+        if (!(in >> halfmove)) halfmove = 0;
+        if (side != "w" && side != "b") return false;
+        if (ep != "-" && (ep.size() != 2 || ep[0] < 'a' || ep[0] > 'h' || (ep[1] != '3' && ep[1] != '6'))) return false;
+        
+        ChessPiece grid[8][8];
+        int x = 0;
+        int y = 7;
+        for (char c : placement) {
+            if (c == '/') {
+                if (x != 8 || y == 0) return false;
+                x = 0;
+                y--;
+            }
+            else if (c >= '1' && c <= '8') x += c - '0';
+            else {
+                char lower = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+                int id = (int)std::string("pnbrqk").find(lower);
+                if (id < 0 || x > 7) return false;
+                int color = (c == lower) ? (1<<1) : (1<<0);
+                grid[x][y] = ChessPiece(color | (1<<(id + 2)));
+                x++;
+            }
+            if (x > 8) return false;
+        }
+        if (x != 8 || y != 0) return false;
+        
+        std::memcpy(board, grid, sizeof(board));
+        sidetomove = (side == "w");
+        castlek = {castling.find('K') != std::string::npos, castling.find('k') != std::string::npos};
+        castleq = {castling.find('Q') != std::string::npos, castling.find('q') != std::string::npos};
+        eps = {-1, -1};
+        if (ep != "-") {
+            if (ep[1] == '3') eps.first = ep[0] - 'a';
+            else eps.second = ep[0] - 'a';
+        }
+        halfmoveclock = halfmove;
+        captures.clear();
+        syncBitboards();
+        return true;
+    }
+    
     bool operator<(ChessGame& other) {
         if (sidetomove != other.sidetomove) return sidetomove < other.sidetomove;
         if (castleq != other.castleq) return castleq < other.castleq;
@@ -226,8 +525,10 @@ struct ChessGame { // A chess game at some particular state
     
     std::vector<Position> getAllPieces(char value) {
         std::vector<Position> res;
-        for (int x = 0; x < 8; x++) {
-            for (int y = 0; y < 8; y++) if (board[x][y].value == value) res.push_back(Position(x, y));
+        uint64_t b = pieces(value);
+        while (b) {
+            int sq = Bitboards::poplsb(b);
+            res.push_back(Position(sq % 8, sq / 8));
         }
         return res;
     }
@@ -285,155 +586,69 @@ struct ChessGame { // A chess game at some particular state
         return board[x][y].isEmpty() || (board[x][y].getColor() != board[s.first][s.second].getColor()); // can capture opposing pieces
     }
     
+    // Is any king of the given side attacked?
+    bool inCheck(bool side) {
+        uint64_t kings = pieces((side ? (1<<0) : (1<<1)) | (1<<7));
+        if (attacksvalid & (side ? 4 : 8)) return attackinfo.masks[side ? 0 : 1].checkers; // Only cached with exactly one king
+        if (attacksvalid & (side ? 2 : 1)) return kings & attackinfo.attacked[side ? 1 : 0];
+        while (kings) {
+            if (isAttacked(Bitboards::poplsb(kings), !side)) return true;
+        }
+        return false;
+    }
+    
     // Are there no checks for the given (sidetomove) player and the current state?
     bool noChecks(bool verbose = false) {
         int you = (sidetomove) ? (1<<0) : (1<<1);
-        int opp = (sidetomove) ? (1<<1) : (1<<0);
-        
-        ChessPiece THISKING(you | (1<<7));
         
         if (verbose) {
             for (auto p : getAllPieces(you | (1<<7))) std::cout << "K" << p.toString() << "\n";
         }
         
-        for (auto p : getAllPieces(opp | (1<<2))) { // Pawns
-            int dy = (sidetomove) ? -1 : 1;
-            int dx[2] = {-1, 1};
-            for (int i = 0; i < 2; i++) {
-                if (!inBounds(p.file() + dx[i], p.rank() + dy)) continue;
-                if (board[p.file() + dx[i]][p.rank() + dy] == THISKING) return false;
-            }
-        }
-        
-        for (auto p : getAllPieces(opp | (1<<3))) { // Knights
-            int dx[8] = {02, 01, -1, -2, -2, -1, 01, 02};
-            int dy[8] = {01, 02, 02, 01, -1, -2, -2, -1};
-            for (int i = 0; i < 8; i++) {
-                if (!inBounds(p.file() + dx[i], p.rank() + dy[i])) continue;
-                if (board[p.file() + dx[i]][p.rank() + dy[i]] == THISKING) return false;
-            }
-        }
-        
-        for (auto p : getAllPieces(opp | (1<<4))) { // Bishops
-            int dx[4] = {01, 01, -1, -1};
-            int dy[4] = {01, -1, 01, -1};
-            for (int i = 0; i < 4; i++) {
-                for (int k = 1; k < 9; k++) {
-                    if (!inBounds(p.file() + dx[i] * k, p.rank() + dy[i] * k)) break;
-                    if (board[p.file() + dx[i] * k][p.rank() + dy[i] * k] == THISKING) return false;
-                    if (!board[p.file() + dx[i] * k][p.rank() + dy[i] * k].isEmpty()) break;
-                }
-            }
-        }
-        
-        for (auto p : getAllPieces(opp | (1<<5))) { // Rooks
-            int dx[4] = {00, 01, 00, -1};
-            int dy[4] = {01, 00, -1, 00};
-            for (int i = 0; i < 4; i++) {
-                for (int k = 1; k < 9; k++) {
-                    if (!inBounds(p.file() + dx[i] * k, p.rank() + dy[i] * k)) break;
-                    if (board[p.file() + dx[i] * k][p.rank() + dy[i] * k] == THISKING) return false;
-                    if (!board[p.file() + dx[i] * k][p.rank() + dy[i] * k].isEmpty()) break;
-                }
-            }
-        }
-        
-        for (auto p : getAllPieces(opp | (1<<6))) { // Queens
-            int dx[8] = {00, 01, 01, 01, 00, -1, -1, -1};
-            int dy[8] = {01, 01, 00, -1, -1, -1, 00, 01};
-            for (int i = 0; i < 8; i++) {
-                for (int k = 1; k < 9; k++) {
-                    if (verbose) std::cout << "{" << p.file() + dx[i] * k << " " << p.rank() + dy[i]  * k << "}\n";
-                    if (!inBounds(p.file() + dx[i] * k, p.rank() + dy[i] * k)) break;
-                    if (board[p.file() + dx[i] * k][p.rank() + dy[i] * k] == THISKING) return false;
-                    if (!board[p.file() + dx[i] * k][p.rank() + dy[i] * k].isEmpty()) break;
-                }
-            }
-        }
-        
-        for (auto p : getAllPieces(opp | (1<<7))) { // Kings
-            int dx[8] = {00, 01, 01, 01, 00, -1, -1, -1};
-            int dy[8] = {01, 01, 00, -1, -1, -1, 00, 01};
-            for (int i = 0; i < 8; i++) {
-                for (int k = 1; k <= 1; k++) {
-                    if (!inBounds(p.file() + dx[i] * k, p.rank() + dy[i] * k)) break;
-                    if (board[p.file() + dx[i] * k][p.rank() + dy[i] * k] == THISKING) return false;
-                    if (!board[p.file() + dx[i] * k][p.rank() + dy[i] * k].isEmpty()) break;
-                }
-            }
-        }
-        
-        return true;
+        return !inCheck(sidetomove);
+    }
+    
+    // The square the side to move lands on when capturing en passant, or an empty Position if there is none.
+    // Only the opponent's double push counts -- a side never takes its own pawn en passant.
+    Position epSquare() {
+        Position enpassant;
+        if (!sidetomove && eps.first >= 0) enpassant = Position(eps.first, 2);
+        if (sidetomove && eps.second >= 0) enpassant = Position(eps.second, 5);
+        return enpassant;
     }
     
-    // Attempts a move and returns if it is pseudolegal.
+    // Returns if a move is pseudolegal. Does not change the game.
     bool pseudolegal(std::pair<int, int> src, std::pair<int, int> vec, bool verbose = false) {
         
         std::pair<int, int> des = {src.first + vec.first, src.second + vec.second};
-        if (!inBounds(des)) return false;
+        if (!inBounds(src) || !inBounds(des)) return false;
         
         ChessPiece piece = board[src.first][src.second];
         ChessPiece victim = board[des.first][des.second];
         if (piece.isEmpty()) return false;
         if (piece.getColor() != sidetomove) return false;
         
-        if (piece.isKing()) { // CASTLING - This does a complete check to keep everything in one place.
-            if (vec == std::make_pair(2, 0)) { // Kingside - towards the H column.
-                if (sidetomove) {
-                    if (!castlek.first) return false;
-                    if (!board[5][0].isEmpty()) return false;
-                    if (!board[6][0].isEmpty()) return false;
-                    
-                    ChessGame game(*this);
-                    game.board[7][0] = ChessPiece(); // Kill off the rook there.
-                    game.execute({4, 0}, {1, 0});
-                    if (!game.noChecks()) return false;
-                    game.execute({5, 0}, {1, 0});
-                    if (!game.noChecks()) return false;
-                }
-                else {
-                    if (!castlek.second) return false;
-                    if (!board[5][7].isEmpty()) return false;
-                    if (!board[6][7].isEmpty()) return false;
-                    
-                    ChessGame game(*this);
-                    game.board[0][0] = ChessPiece(); // Kill off the rook there.
-                    game.execute({4, 0}, {-1, 0});
-                    if (!game.noChecks()) return false;
-                    game.execute({3, 0}, {-1, 0});
-                    if (!game.noChecks()) return false;
-                }
-                return true;
+        if (piece.isKing() && vec.second == 0 && abs(vec.first) == 2) { // CASTLING - The king may not start on, pass through or land on an attacked square.
+            int rank = (sidetomove) ? 0 : 7;
+            char rook = (1<<5) | ((sidetomove) ? (1<<0) : (1<<1));
+            if (src != std::make_pair(4, rank)) return false;
+            
+            if (vec.first == 2) { // Kingside - towards the H column.
+                if (!(sidetomove ? castlek.first : castlek.second)) return false;
+                if (board[7][rank].value != rook) return false;
+                if (!board[5][rank].isEmpty()) return false;
+                if (!board[6][rank].isEmpty()) return false;
+                if (attacked(!sidetomove) & (7ULL << Bitboards::square(4, rank))) return false; // e, f, g
             }
-            else if (vec == std::make_pair(-2, 0)) {
-                if (sidetomove) {
-                    if (!castleq.first) return false;
-                    if (!board[1][0].isEmpty()) return false;
-                    if (!board[2][0].isEmpty()) return false;
-                    if (!board[3][0].isEmpty()) return false;
-                    
-                    ChessGame game(*this);
-                    game.board[7][7] = ChessPiece(); // Kill off the rook there.
-                    game.execute({4, 7}, {1, 0});
-                    if (!game.noChecks()) return false;
-                    game.execute({5, 7}, {1, 0});
-                    if (!game.noChecks()) return false;
-                }
-                else {
-                    if (!castleq.second) return false;
-                    if (!board[1][7].isEmpty()) return false;
-                    if (!board[2][7].isEmpty()) return false;
-                    if (!board[3][7].isEmpty()) return false;
-                    
-                    ChessGame game(*this);
-                    game.board[0][7] = ChessPiece(); // Kill off the rook there.
-                    game.execute({4, 7}, {-1, 0});
-                    if (!game.noChecks()) return false;
-                    game.execute({3, 7}, {-1, 0});
-                    if (!game.noChecks()) return false;
-                }
-                return true;
+            else {
+                if (!(sidetomove ? castleq.first : castleq.second)) return false;
+                if (board[0][rank].value != rook) return false;
+                if (!board[1][rank].isEmpty()) return false;
+                if (!board[2][rank].isEmpty()) return false;
+                if (!board[3][rank].isEmpty()) return false;
+                if (attacked(!sidetomove) & (7ULL << Bitboards::square(2, rank))) return false; // c, d, e
             }
+            return true;
         }
         
         if (!isLegalVector(piece, vec)) return false;
@@ -462,51 +677,35 @@ struct ChessGame { // A chess game at some particular state
         
         // Pawn capturing check
         
-        Position enpassant;
-        if (eps.first >= 0) enpassant = Position(eps.first, 2);
-        if (eps.second >= 0) enpassant = Position(eps.second, 5);
+        Position enpassant = epSquare();
         
         if (verbose) std::cout << enpassant.pp().first << " " << enpassant.pp().second << "<<\n";
         
         if (piece.isPawn()) {
             if (abs(vec.first) == 1) {
-                if (victim.isEmpty() && enpassant.value != -1 && enpassant.pp() == des) {
-                    // Capture EP
-                    return true;
-                }
-                if (capture) {
-                    // Capture NON-EP
-                    eps.first = -1;
-                    eps.second = -1;
-                    return true;
-                }
+                if (victim.isEmpty() && enpassant.value != -1 && enpassant.pp() == des) return true; // Capture EP
+                if (capture) return true; // Capture NON-EP
                 if (victim.isEmpty()) return false;
             }
         }
         
-        // En passant square -- reset automatically
-        
-        eps.first = -1;
-        eps.second = -1;
-        
-        // Mark the relevant file. From this value and its place in the pair we can determine where the ep happens.
-        
-        if (piece.isPawn() && (abs(vec.second) == 2)) {
-            if (sidetomove) eps.first = src.first;
-            else eps.second = src.first;
-        }
-        
         // All other captures and moves
         
         return true;
     }
     
     // Moves a piece regardless of legality. If certain conditions are met (e.g. enpassant, castling) those actions are taken.
-    void execute(std::pair<int, int> src, std::pair<int, int> vec, bool verbose = false) {
+    // The en passant file is cleared and, for a double pawn push, set again for the side that moved.
+    // Pawns reaching the last rank become the piece with the given bit (QUEEN unless told otherwise).
+    void execute(std::pair<int, int> src, std::pair<int, int> vec, bool verbose = false, int promotion = 6) {
         captures.clear();
         std::pair<int, int> des = {src.first + vec.first, src.second + vec.second};
         ChessPiece temp = board[src.first][src.second];
         
+        Position enpassant = epSquare();
+        hash ^= stateHash();
+        eps = {-1, -1};
+        
         // Update castling rights
         
         if (temp.isKing()) {
@@ -514,48 +713,47 @@ struct ChessGame { // A chess game at some particular state
             else castleq.second = castlek.second = false;
         }
         
-        if (temp.isRook() && src.first == 0) {
-            if (sidetomove) castleq.first = false;
-            else castleq.second = false;
-        }
+        // A rook leaving its corner, or anything landing on a corner (capturing the rook there), ends castling on that side.
         
-        if (temp.isRook() && src.first == 7) {
-            if (sidetomove) castlek.first = false;
-            else castlek.second = false;
-        }
+        if (src == std::make_pair(0, 0) || des == std::make_pair(0, 0)) castleq.first = false;
+        if (src == std::make_pair(7, 0) || des == std::make_pair(7, 0)) castlek.first = false;
+        if (src == std::make_pair(0, 7) || des == std::make_pair(0, 7)) castleq.second = false;
+        if (src == std::make_pair(7, 7) || des == std::make_pair(7, 7)) castlek.second = false;
         
         // If the king moves 2 cells horizontally we assume castle and the corresponding cell moves inversely.
         if (temp.isKing()) {
             if (vec == std::make_pair(-2, 0)) {
                 if (sidetomove) {
-                    board[0][0] = ChessPiece();
-                    board[4][0] = ChessPiece();
-                    board[2][0] = ChessPiece((1<<7) | (1<<0));
-                    board[3][0] = ChessPiece((1<<5) | (1<<0));
+                    setPiece(0, 0, ChessPiece());
+                    setPiece(4, 0, ChessPiece());
+                    setPiece(2, 0, ChessPiece((1<<7) | (1<<0)));
+                    setPiece(3, 0, ChessPiece((1<<5) | (1<<0)));
                 }
                 else {
-                    board[0][7] = ChessPiece();
-                    board[4][7] = ChessPiece();
-                    board[2][7] = ChessPiece((1<<7) | (1<<1));
-                    board[3][7] = ChessPiece((1<<5) | (1<<1));
+                    setPiece(0, 7, ChessPiece());
+                    setPiece(4, 7, ChessPiece());
+                    setPiece(2, 7, ChessPiece((1<<7) | (1<<1)));
+                    setPiece(3, 7, ChessPiece((1<<5) | (1<<1)));
                 }
                 halfmoveclock++;
+                hash ^= stateHash();
                 return;
             }
             if (vec == std::make_pair(2, 0)) {
                 if (sidetomove) {
-                    board[7][0] = ChessPiece();
-                    board[4][0] = ChessPiece();
-                    board[6][0] = ChessPiece((1<<7) | (1<<0));
-                    board[5][0] = ChessPiece((1<<5) | (1<<0));
+                    setPiece(7, 0, ChessPiece());
+                    setPiece(4, 0, ChessPiece());
+                    setPiece(6, 0, ChessPiece((1<<7) | (1<<0)));
+                    setPiece(5, 0, ChessPiece((1<<5) | (1<<0)));
                 }
                 else {
-                    board[7][7] = ChessPiece();
-                    board[4][7] = ChessPiece();
-                    board[6][7] = ChessPiece((1<<7) | (1<<1));
-                    board[5][7] = ChessPiece((1<<5) | (1<<1));
+                    setPiece(7, 7, ChessPiece());
+                    setPiece(4, 7, ChessPiece());
+                    setPiece(6, 7, ChessPiece((1<<7) | (1<<1)));
+                    setPiece(5, 7, ChessPiece((1<<5) | (1<<1)));
                 }
                 halfmoveclock++;
+                hash ^= stateHash();
                 return;
             }
         }
@@ -563,248 +761,449 @@ struct ChessGame { // A chess game at some particular state
         if (!board[des.first][des.second].isEmpty()) halfmoveclock = 0;
         else if (temp.isPawn()) halfmoveclock = 0;
         else halfmoveclock++;
-        board[src.first][src.second] = ChessPiece();
+        setPiece(src.first, src.second, ChessPiece());
         
         if (!board[des.first][des.second].isEmpty()) {
             if (verbose) std::cout << des.first << " " << des.second << board[des.first][des.second].toString() << " CAPTURED\n";
             captures.push_back(ChessPiece(board[des.first][des.second]));
         }
         
-        board[des.first][des.second] = temp;
-        
-        Position enpassant;
-        if (eps.first >= 0) enpassant = Position(eps.first, 2);
-        if (eps.second >= 0) enpassant = Position(eps.second, 5);
+        setPiece(des.first, des.second, temp);
         
-        // std::cout << enpassant.pp().first << " " << enpassant.pp().second << ">>\n";
         if (verbose) std::cout << des.first << " " << des.second << ">>\n";
         if (verbose) std::cout << enpassant.toString() << ">>\n";
         
-        if (enpassant.pp() == des) {
+        if (temp.isPawn() && enpassant.pp() == des) {
             if (sidetomove) {
                 captures.push_back(board[des.first][des.second - 1]);
-                board[des.first][des.second - 1] = ChessPiece();
+                setPiece(des.first, des.second - 1, ChessPiece());
             }
             else {
                 captures.push_back(board[des.first][des.second + 1]);
-                board[des.first][des.second + 1] = ChessPiece();
+                setPiece(des.first, des.second + 1, ChessPiece());
             }
         }
         
+        // Mark the relevant file. From this value and its place in the pair we can determine where the ep happens.
+        
+        if (temp.isPawn() && abs(vec.second) == 2) {
+            if (sidetomove) eps.first = src.first;
+            else eps.second = src.first;
+        }
+        
         if (temp.isPawn()) {
             int you = (sidetomove) ? (1<<0) : (1<<1);
-            if (sidetomove && des.second == 7) board[des.first][des.second] = ChessPiece(you | (1<<6));
-            else if (!sidetomove && des.second == 0) board[des.first][des.second] = ChessPiece(you | (1<<6));
+            if (sidetomove && des.second == 7) setPiece(des.first, des.second, ChessPiece(you | (1<<promotion)));
+            else if (!sidetomove && des.second == 0) setPiece(des.first, des.second, ChessPiece(you | (1<<promotion)));
         }
+        
+        hash ^= stateHash();
     }
     
-    bool legal(std::pair<int, int> src, std::pair<int, int> vec, bool verbose = false) {
+    void execute(Move m, bool verbose = false) {
+        execute(m.src(), m.vec(), verbose, m.isPromotion() ? m.promotion() : 6);
+    }
+    
+    // Everything execute() throws away that unmakeMove() needs to put the game back.
+    struct UndoInfo {
+        ChessPiece moved;
+        ChessPiece captured;
+        char capturesquare = -1; // Differs from the destination for en passant
+        ChessPiece lastcapture; // captures from the previous move (a move never takes more than one piece)
+        std::pair<bool, bool> castleq;
+        std::pair<bool, bool> castlek;
+        std::pair<char, char> eps;
+        int halfmoveclock;
+        uint64_t hash;
+    };
+    
+    // Plays a move in place and passes the turn. Pair with unmakeMove() to walk a search tree on one board instead of copying it.
+    UndoInfo makeMove(std::pair<int, int> src, std::pair<int, int> vec, int promotion = 6) {
         std::pair<int, int> des = {src.first + vec.first, src.second + vec.second};
-        if (!pseudolegal(src, vec)) return false;
-        
-        // Test the move
-        
-        ChessGame game(*this);
-        game.execute(src, vec);
+        UndoInfo undo;
+        undo.moved = board[src.first][src.second];
+        undo.castleq = castleq;
+        undo.castlek = castlek;
+        undo.eps = eps;
+        undo.halfmoveclock = halfmoveclock;
+        undo.hash = hash;
+        if (!captures.empty()) undo.lastcapture = captures[0];
+        
+        bool castle = undo.moved.isKing() && vec.second == 0 && abs(vec.first) == 2;
+        if (!castle) {
+            std::pair<int, int> cap = des;
+            if (undo.moved.isPawn() && board[des.first][des.second].isEmpty() && epSquare().pp() == des) cap.second -= (sidetomove) ? 1 : -1;
+            undo.captured = board[cap.first][cap.second];
+            undo.capturesquare = Position(cap).value;
+        }
         
-        if (verbose) std::cout << toString() << "\n" << game.toString() << "\n";
+        execute(src, vec, false, promotion);
+        sidetomove = !sidetomove;
+        return undo;
+    }
+    
+    UndoInfo makeMove(Move m) {
+        return makeMove(m.src(), m.vec(), m.isPromotion() ? m.promotion() : 6);
+    }
+    
+    void unmakeMove(std::pair<int, int> src, std::pair<int, int> vec, UndoInfo& undo) {
+        std::pair<int, int> des = {src.first + vec.first, src.second + vec.second};
+        sidetomove = !sidetomove;
+        
+        if (undo.moved.isKing() && vec.second == 0 && abs(vec.first) == 2) {
+            int rank = src.second;
+            char rook = (1<<5) | (undo.moved.value & 3);
+            int rx = (vec.first > 0) ? 7 : 0;
+            setPiece(des.first, rank, ChessPiece());
+            setPiece(src.first + vec.first / 2, rank, ChessPiece());
+            setPiece(rx, rank, ChessPiece(rook));
+        }
+        else setPiece(des, ChessPiece());
         
-        // Brute force all possible checking checks
+        setPiece(src, undo.moved);
+        if (!undo.captured.isEmpty()) setPiece(undo.capturesquare % 8, undo.capturesquare / 8, undo.captured);
         
-        return game.noChecks(verbose);
+        castleq = undo.castleq;
+        castlek = undo.castlek;
+        eps = undo.eps;
+        halfmoveclock = undo.halfmoveclock;
+        hash = undo.hash;
+        captures.clear();
+        if (!undo.lastcapture.isEmpty()) captures.push_back(undo.lastcapture);
     }
     
-    std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> getAllLegalMoves(bool verbose = false) {
-        std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> res;
+    void unmakeMove(Move m, UndoInfo& undo) {
+        unmakeMove(m.src(), m.vec(), undo);
+    }
+
+    // Passes the turn without moving (null move pruning in the search). Only the en passant file and the turn change.
+    UndoInfo makeNullMove() {
+        UndoInfo undo;
+        undo.eps = eps;
+        undo.halfmoveclock = halfmoveclock;
+        undo.hash = hash;
+        if (!captures.empty()) undo.lastcapture = captures[0];
+
+        hash ^= stateHash();
+        eps = {-1, -1};
+        hash ^= stateHash();
+        halfmoveclock++;
+        captures.clear();
+        sidetomove = !sidetomove;
+        return undo;
+    }
+
+    void unmakeNullMove(UndoInfo& undo) {
+        sidetomove = !sidetomove;
+        eps = undo.eps;
+        halfmoveclock = undo.halfmoveclock;
+        hash = undo.hash;
+        captures.clear();
+        if (!undo.lastcapture.isEmpty()) captures.push_back(undo.lastcapture);
+    }
+    
+    // Packs a (source, vector) move for the current position. Promotions default to QUEEN.
+    Move toMove(std::pair<int, int> src, std::pair<int, int> vec, int promotion = 6) {
+        std::pair<int, int> des = {src.first + vec.first, src.second + vec.second};
+        ChessPiece piece = board[src.first][src.second];
+        int flag = 0;
+        if (piece.isKing() && vec.second == 0 && abs(vec.first) == 2) flag = 2;
+        if (piece.isPawn()) {
+            if (abs(vec.second) == 2) flag = 1;
+            else if (vec.first != 0 && board[des.first][des.second].isEmpty()) flag = 3;
+            if (des.second == 0 || des.second == 7) flag = promotion + 1;
+        }
+        return Move(Position(src).value, Position(des).value, flag);
+    }
+    
+    bool legal(std::pair<int, int> src, std::pair<int, int> vec, bool verbose = false) {
+        if (!pseudolegal(src, vec)) return false;
         
-        int you = (sidetomove) ? (1<<0) : (1<<1);
+        // Test the move on this board and take it back
         
-        ChessPiece THISKING(you | (1<<7));
+        bool side = sidetomove;
+        UndoInfo undo = makeMove(src, vec);
         
-        if (verbose) {
-            for (auto p : getAllPieces(you | (1<<7))) std::cout << "K" << p.toString() << "\n";
-        }
+        if (verbose) std::cout << toString() << "\n";
         
-        for (auto p : getAllPieces(you | (1<<2))) { // Pawns
-            int dy = (sidetomove) ? 1 : -1;
-            int dx[2] = {-1, 1};
-            for (int i = 1; i <= 2; i++) {
-                std::pair<int, int> vec = {0, dy * i};
-                if (legal(p.pos(), vec)) res.push_back({p.pos(), vec});
-                
-                vec = {dx[i], dy};
-                if (legal(p.pos(), vec)) res.push_back({p.pos(), vec});
-            }
+        bool res = !inCheck(side);
+        unmakeMove(src, vec, undo);
+        return res;
+    }
+    
+    // Check and pin masks for one side, cached in the AttackInfo. The side must have exactly one king.
+    const LegalMasks& legalMasks(bool side) {
+        int c = side ? 0 : 1;
+        if (!(attacksvalid & (4 << c))) {
+            attackinfo.masks[c] = computeLegalMasks(side);
+            attacksvalid |= 4 << c;
         }
-        
-        for (auto p : getAllPieces(you | (1<<3))) { // Knights
-            int dx[8] = {02, 01, -1, -2, -2, -1, 01, 02};
-            int dy[8] = {01, 02, 02, 01, -1, -2, -2, -1};
-            for (int i = 0; i < 8; i++) {
-                std::pair<int, int> vec = {dx[i], dy[i]};
-                if (legal(p.pos(), vec)) res.push_back({p.pos(), vec});
+        return attackinfo.masks[c];
+    }
+    
+    LegalMasks computeLegalMasks(bool side) {
+        LegalMasks res;
+        uint64_t own = bitboards[side ? 0 : 1];
+        uint64_t them = bitboards[side ? 1 : 0];
+        uint64_t occ = own | them;
+        uint64_t kings = own & bitboards[7];
+        
+        res.ksq = Bitboards::lsb(kings);
+        res.checkers = attackersTo(res.ksq, occ) & them;
+        res.danger = attacksBy(!side, occ ^ kings); // Without the king, so it cannot step back along a checking ray
+        
+        res.evasions = ~0ULL;
+        if (res.checkers) res.evasions = (Bitboards::popcount(res.checkers) > 1) ? 0 : (res.checkers | Bitboards::between(res.ksq, Bitboards::lsb(res.checkers)));
+        
+        // Pinned pieces -- the only piece between the king and an enemy slider on the same line.
+        res.pinned = 0;
+        uint64_t snipers = (Bitboards::rookAttacks(res.ksq, them) & (bitboards[5] | bitboards[6])) | (Bitboards::bishopAttacks(res.ksq, them) & (bitboards[4] | bitboards[6]));
+        snipers &= them;
+        while (snipers) {
+            uint64_t blockers = Bitboards::between(res.ksq, Bitboards::poplsb(snipers)) & occ;
+            if (Bitboards::popcount(blockers) == 1) res.pinned |= blockers & own;
+        }
+        return res;
+    }
+    
+    // Legal move counts for one side's knights, bishops, rooks and queens (by square) and its king (castling left out), as if that side were to move.
+    // Same masks as generateMoves() without building a move list. Returns false unless the side has exactly one king.
+    bool mobility(bool side, int counts[64], int& kingmoves) {
+        uint64_t own = bitboards[side ? 0 : 1];
+        uint64_t them = bitboards[side ? 1 : 0];
+        uint64_t occ = own | them;
+        if (Bitboards::popcount(own & bitboards[7]) != 1) return false;
+        
+        const LegalMasks& masks = legalMasks(side);
+        uint64_t open = ~own & ~(them & bitboards[7]);
+        for (int id = 3; id < 7; id++) {
+            uint64_t b = own & bitboards[id];
+            while (b) {
+                int sq = Bitboards::poplsb(b);
+                uint64_t targets = 0;
+                if (id == 3) targets = Bitboards::knightAttacks(sq);
+                if (id == 4) targets = Bitboards::bishopAttacks(sq, occ);
+                if (id == 5) targets = Bitboards::rookAttacks(sq, occ);
+                if (id == 6) targets = Bitboards::queenAttacks(sq, occ);
+                targets &= open & masks.evasions;
+                if (masks.pinned & Bitboards::bit(sq)) targets &= Bitboards::line(masks.ksq, sq);
+                counts[sq] = Bitboards::popcount(targets);
             }
         }
-        
-        for (auto p : getAllPieces(you | (1<<4))) { // Bishops
-            int dx[4] = {01, 01, -1, -1};
-            int dy[4] = {01, -1, 01, -1};
-            for (int i = 0; i < 4; i++) {
-                for (int k = 1; k < 9; k++) {
-                    std::pair<int, int> vec = {dx[i] * k, dy[i] * k};
-                    if (legal(p.pos(), vec)) res.push_back({p.pos(), vec});
+        kingmoves = Bitboards::popcount(Bitboards::kingAttacks(masks.ksq) & open & ~masks.danger);
+        return true;
+    }
+    
+    // Fills the list with every legal move for the side to move, including castling and all four promotions.
+    // Checkers and pinned pieces are found once per position so candidates are masked instead of played and tested.
+    // With capturesOnly only captures (en passant included) and QUEEN promotions are listed -- what a quiescence search looks at.
+    void generateMoves(MoveList& list, bool capturesOnly = false) {
+        list.clear();
+        
+        int c = (sidetomove) ? 0 : 1;
+        uint64_t own = bitboards[c];
+        uint64_t them = bitboards[1 - c];
+        uint64_t occ = own | them;
+        uint64_t kings = own & bitboards[7];
+        if (Bitboards::popcount(kings) != 1) {
+            generateMovesByTesting(list);
+            if (capturesOnly) {
+                MoveList all = list;
+                list.clear();
+                for (Move m : all) {
+                    if (m.isEnPassant() || (m.isPromotion() && m.promotion() == 6) || (!m.isPromotion() && (them & Bitboards::bit(m.to())))) list.push(m);
                 }
             }
+            return;
         }
         
-        for (auto p : getAllPieces(you | (1<<5))) { // Rooks
-            int dx[4] = {00, 01, 00, -1};
-            int dy[4] = {01, 00, -1, 00};
-            for (int i = 0; i < 4; i++) {
-                for (int k = 1; k < 9; k++) {
-                    std::pair<int, int> vec = {dx[i] * k, dy[i] * k};
-                    if (legal(p.pos(), vec)) res.push_back({p.pos(), vec});
+        const LegalMasks& masks = legalMasks(sidetomove);
+        int ksq = masks.ksq;
+        uint64_t checkers = masks.checkers;
+        uint64_t danger = masks.danger;
+        uint64_t evasions = masks.evasions;
+        uint64_t pinned = masks.pinned;
+        uint64_t open = ~own & ~(them & bitboards[7]); // Cannot capture king directly
+        uint64_t quiet = (capturesOnly) ? 0 : ~0ULL; // Where non-captures may land
+        
+        // Pawns -- single push, double push, then the two captures, in the same order as before.
+        
+        int dy = (sidetomove) ? 1 : -1;
+        Position enpassant = epSquare();
+        uint64_t pawns = own & bitboards[2];
+        while (pawns) {
+            int sq = Bitboards::poplsb(pawns);
+            int x = sq % 8;
+            int y = sq / 8;
+            if (y + dy < 0 || y + dy > 7) continue;
+            
+            uint64_t allowed = open & evasions;
+            if (pinned & Bitboards::bit(sq)) allowed &= Bitboards::line(ksq, sq);
+            
+            int one = Bitboards::square(x, y + dy);
+            if (!(occ & Bitboards::bit(one))) {
+                bool promotes = (y + dy == 0 || y + dy == 7);
+                if ((allowed & Bitboards::bit(one)) && (promotes || !capturesOnly)) pushPawnMove(list, sq, one, capturesOnly);
+                int two = Bitboards::square(x, y + 2 * dy);
+                if (y == ((sidetomove) ? 1 : 6) && !(occ & Bitboards::bit(two)) && (allowed & quiet & Bitboards::bit(two))) list.push(Move(sq, two, 1));
+            }
+            
+            for (int dx = -1; dx <= 1; dx += 2) {
+                if (x + dx < 0 || x + dx > 7) continue;
+                int des = Bitboards::square(x + dx, y + dy);
+                if (them & allowed & Bitboards::bit(des)) pushPawnMove(list, sq, des, capturesOnly);
+                else if (enpassant.value == des && !(occ & Bitboards::bit(des))) { // Two pawns leave the rank at once -- just test it
+                    if (legal({x, y}, {dx, dy})) list.push(Move(sq, des, 3));
                 }
             }
         }
         
-        for (auto p : getAllPieces(you | (1<<6))) { // Queens
-            int dx[8] = {00, 01, 01, 01, 00, -1, -1, -1};
-            int dy[8] = {01, 01, 00, -1, -1, -1, 00, 01};
-            for (int i = 0; i < 8; i++) {
-                for (int k = 1; k < 9; k++) {
-                    std::pair<int, int> vec = {dx[i] * k, dy[i] * k};
-                    if (legal(p.pos(), vec)) res.push_back({p.pos(), vec});
-                }
+        for (int id = 3; id < 7; id++) { // Knights, bishops, rooks, queens
+            uint64_t b = own & bitboards[id];
+            while (b) {
+                int sq = Bitboards::poplsb(b);
+                uint64_t targets = 0;
+                if (id == 3) targets = Bitboards::knightAttacks(sq);
+                if (id == 4) targets = Bitboards::bishopAttacks(sq, occ);
+                if (id == 5) targets = Bitboards::rookAttacks(sq, occ);
+                if (id == 6) targets = Bitboards::queenAttacks(sq, occ);
+                targets &= open & evasions & (them | quiet);
+                if (pinned & Bitboards::bit(sq)) targets &= Bitboards::line(ksq, sq);
+                while (targets) list.push(Move(sq, Bitboards::poplsb(targets)));
             }
         }
         
-        for (auto p : getAllPieces(you | (1<<7))) { // Kings
-            int dx[8] = {00, 01, 01, 01, 00, -1, -1, -1};
-            int dy[8] = {01, 01, 00, -1, -1, -1, 00, 01};
-            for (int i = 0; i < 8; i++) {
-                for (int k = 1; k <= 1; k++) {
-                    std::pair<int, int> vec = {dx[i] * k, dy[i] * k};
-                    if (legal(p.pos(), vec)) res.push_back({p.pos(), vec});
-                }
+        uint64_t targets = Bitboards::kingAttacks(ksq) & open & ~danger & (them | quiet);
+        while (targets) list.push(Move(ksq, Bitboards::poplsb(targets)));
+        if (capturesOnly) return;
+        
+        // Castling - The king may not start on, pass through or land on an attacked square.
+        int rank = (sidetomove) ? 0 : 7;
+        char rook = (1<<5) | ((sidetomove) ? (1<<0) : (1<<1));
+        if (!checkers && ksq == Bitboards::square(4, rank)) {
+            if ((sidetomove ? castlek.first : castlek.second) && board[7][rank].value == rook) {
+                uint64_t path = Bitboards::bit(ksq + 1) | Bitboards::bit(ksq + 2);
+                if (!(occ & path) && !(danger & path)) list.push(Move(ksq, ksq + 2, 2));
+            }
+            if ((sidetomove ? castleq.first : castleq.second) && board[0][rank].value == rook) {
+                uint64_t path = Bitboards::bit(ksq - 1) | Bitboards::bit(ksq - 2);
+                if (!(occ & (path | Bitboards::bit(ksq - 3))) && !(danger & path)) list.push(Move(ksq, ksq - 2, 2));
             }
         }
-        
-        return res;
     }
     
-    // Get all instances where a piece can capture another piece of the same color if said piece was the opposing color.
-    std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> getDefenses(bool verbose = false) {
-        std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> res;
+    // Pushes a pawn move, or all four promotions (QUEEN first) when it reaches the last rank.
+    void pushPawnMove(MoveList& list, int src, int des, bool queenOnly = false) {
+        if (des / 8 == 0 || des / 8 == 7) {
+            for (int id = 6; id >= (queenOnly ? 6 : 3); id--) list.push(Move(src, des, id + 1));
+        }
+        else list.push(Move(src, des));
+    }
+    
+    // Same as generateMoves() but plays and takes back every candidate. Used for setups without exactly one king of the side to move.
+    void generateMovesByTesting(MoveList& list) {
+        list.clear();
         
         int you = (sidetomove) ? (1<<0) : (1<<1);
+        uint64_t own = bitboards[sidetomove ? 0 : 1];
+        uint64_t occ = occupancy();
         
-        ChessPiece THISKING(you | (1<<7));
-        
-        if (verbose) {
-            for (auto p : getAllPieces(you | (1<<7))) std::cout << "K" << p.toString() << "\n";
-        }
+        // Candidate destinations come straight from the bitboards; legal() still has the final say.
         
-        for (auto p : getAllPieces(you | (1<<2))) { // Pawns
+        uint64_t pawns = pieces(you | (1<<2));
+        while (pawns) { // Pawns
+            int sq = Bitboards::poplsb(pawns);
+            std::pair<int, int> src = {sq % 8, sq / 8};
             int dy = (sidetomove) ? 1 : -1;
-            int dx[2] = {-1, 1};
-            for (int i = 1; i <= 2; i++) {
-                std::pair<int, int> vec = {dx[i], dy};
-                std::pair<int, int> des = {p.pos().first + vec.first, p.pos().second + vec.second};
-                if (inBounds(des)) {
-                    ChessPiece victim = board[des.first][des.second];
-                    if (!victim.isEmpty() && victim.getColor() == sidetomove) res.push_back({p.pos(), des});
+            std::pair<int, int> vecs[4] = {{0, dy}, {0, 2 * dy}, {-1, dy}, {1, dy}};
+            for (int i = 0; i < 4; i++) {
+                if (!legal(src, vecs[i])) continue;
+                Move m = toMove(src, vecs[i]);
+                if (m.isPromotion()) {
+                    for (int id = 6; id >= 3; id--) list.push(toMove(src, vecs[i], id));
                 }
+                else list.push(m);
             }
         }
         
-        for (auto p : getAllPieces(you | (1<<3))) { // Knights
-            int dx[8] = {02, 01, -1, -2, -2, -1, 01, 02};
-            int dy[8] = {01, 02, 02, 01, -1, -2, -2, -1};
-            for (int i = 0; i < 8; i++) {
-                std::pair<int, int> vec = {dx[i], dy[i]};
-                std::pair<int, int> des = {p.pos().first + vec.first, p.pos().second + vec.second};
-                if (inBounds(des)) {
-                    ChessPiece victim = board[des.first][des.second];
-                    if (!victim.isEmpty() && victim.getColor() == sidetomove) res.push_back({p.pos(), des});
+        for (int id = 3; id < 8; id++) { // Knights, bishops, rooks, queens, kings
+            uint64_t b = pieces(you | (1<<id));
+            while (b) {
+                int sq = Bitboards::poplsb(b);
+                uint64_t targets = 0;
+                if (id == 3) targets = Bitboards::knightAttacks(sq);
+                if (id == 4) targets = Bitboards::bishopAttacks(sq, occ);
+                if (id == 5) targets = Bitboards::rookAttacks(sq, occ);
+                if (id == 6) targets = Bitboards::queenAttacks(sq, occ);
+                if (id == 7) targets = Bitboards::kingAttacks(sq);
+                targets &= ~own;
+                
+                std::pair<int, int> src = {sq % 8, sq / 8};
+                while (targets) {
+                    int des = Bitboards::poplsb(targets);
+                    std::pair<int, int> vec = {des % 8 - src.first, des / 8 - src.second};
+                    if (legal(src, vec)) list.push(Move(sq, des));
+                }
+                
+                if (id == 7) { // Castling
+                    if (legal(src, {2, 0})) list.push(Move(sq, sq + 2, 2));
+                    if (legal(src, {-2, 0})) list.push(Move(sq, sq - 2, 2));
                 }
             }
         }
+    }
+    
+    // Same moves as generateMoves() in (source, vector) form. Promotions are listed once and always promote to QUEEN.
+    std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> getAllLegalMoves(bool verbose = false) {
+        std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> res;
         
-        for (auto p : getAllPieces(you | (1<<4))) { // Bishops
-            int dx[4] = {01, 01, -1, -1};
-            int dy[4] = {01, -1, 01, -1};
-            for (int i = 0; i < 4; i++) {
-                for (int k = 1; k < 9; k++) {
-                    std::pair<int, int> vec = {dx[i] * k, dy[i] * k};
-                    std::pair<int, int> des = {p.pos().first + vec.first, p.pos().second + vec.second};
-                    if (inBounds(des)) {
-                        ChessPiece victim = board[des.first][des.second];
-                        if (!victim.isEmpty() && victim.getColor() == sidetomove) {
-                            res.push_back({p.pos(), des});
-                            break; // Only one for sliding
-                        }
-                    }
-                }
-            }
+        int you = (sidetomove) ? (1<<0) : (1<<1);
+        
+        if (verbose) {
+            for (auto p : getAllPieces(you | (1<<7))) std::cout << "K" << p.toString() << "\n";
         }
         
-        for (auto p : getAllPieces(you | (1<<5))) { // Rooks
-            int dx[4] = {00, 01, 00, -1};
-            int dy[4] = {01, 00, -1, 00};
-            for (int i = 0; i < 4; i++) {
-                for (int k = 1; k < 9; k++) {
-                    std::pair<int, int> vec = {dx[i] * k, dy[i] * k};
-                    std::pair<int, int> des = {p.pos().first + vec.first, p.pos().second + vec.second};
-                    if (inBounds(des)) {
-                        ChessPiece victim = board[des.first][des.second];
-                        if (!victim.isEmpty() && victim.getColor() == sidetomove) {
-                            res.push_back({p.pos(), des});
-                            break; // Only one for sliding
-                        }
-                    }
-                }
-            }
+        MoveList list;
+        generateMoves(list);
+        for (Move m : list) {
+            if (m.isPromotion() && m.promotion() != 6) continue;
+            res.push_back({m.src(), m.vec()});
         }
         
-        for (auto p : getAllPieces(you | (1<<6))) { // Queens
-            int dx[8] = {00, 01, 01, 01, 00, -1, -1, -1};
-            int dy[8] = {01, 01, 00, -1, -1, -1, 00, 01};
-            for (int i = 0; i < 8; i++) {
-                for (int k = 1; k < 9; k++) {
-                    std::pair<int, int> vec = {dx[i] * k, dy[i] * k};
-                    std::pair<int, int> des = {p.pos().first + vec.first, p.pos().second + vec.second};
-                    if (inBounds(des)) {
-                        ChessPiece victim = board[des.first][des.second];
-                        if (!victim.isEmpty() && victim.getColor() == sidetomove) {
-                            res.push_back({p.pos(), des});
-                            break; // Only one for sliding
-                        }
-                    }
-                }
-            }
+        return res;
+    }
+    
+    // Get all instances where a piece can capture another piece of the same color if said piece was the opposing color.
+    // Sliders look through enemy pieces and stop at the first friendly one (the occupancy passed to the tables is our own pieces only).
+    std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> getDefenses(bool verbose = false) {
+        std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> res;
+        
+        int you = (sidetomove) ? (1<<0) : (1<<1);
+        uint64_t own = bitboards[sidetomove ? 0 : 1];
+        
+        if (verbose) {
+            for (auto p : getAllPieces(you | (1<<7))) std::cout << "K" << p.toString() << "\n";
         }
         
-        for (auto p : getAllPieces(you | (1<<7))) { // Kings
-            int dx[8] = {00, 01, 01, 01, 00, -1, -1, -1};
-            int dy[8] = {01, 01, 00, -1, -1, -1, 00, 01};
-            for (int i = 0; i < 8; i++) {
-                for (int k = 1; k <= 1; k++) {
-                    std::pair<int, int> vec = {dx[i] * k, dy[i] * k};
-                    std::pair<int, int> des = {p.pos().first + vec.first, p.pos().second + vec.second};
-                    if (inBounds(des)) {
-                        ChessPiece victim = board[des.first][des.second];
-                        if (!victim.isEmpty() && victim.getColor() == sidetomove) {
-                            res.push_back({p.pos(), des});
-                        }
-                    }
+        for (int id = 2; id < 8; id++) {
+            for (auto p : getAllPieces(you | (1<<id))) {
+                int sq = p.value;
+                uint64_t targets = 0;
+                if (id == 2) targets = Bitboards::pawnAttacks(sidetomove ? 0 : 1, sq);
+                if (id == 3) targets = Bitboards::knightAttacks(sq);
+                if (id == 4) targets = Bitboards::bishopAttacks(sq, own);
+                if (id == 5) targets = Bitboards::rookAttacks(sq, own);
+                if (id == 6) targets = Bitboards::queenAttacks(sq, own);
+                if (id == 7) targets = Bitboards::kingAttacks(sq);
+                targets &= own;
+                
+                while (targets) {
+                    int des = Bitboards::poplsb(targets);
+                    res.push_back({p.pos(), {des % 8, des / 8}});
                 }
             }
         }
         
-        // std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> res2;
-        // for (auto p : res) res2.push_back(std::make_pair(std::make_pair(p.first.first, p.first.second), std::make_pair(p.second.first, p.second.second)));
-        
         return res;
     }
     
@@ -0,0 +1,49 @@
+#ifndef EVALCACHE_H
+#define EVALCACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <atomic>
+
+// Evaluation cache -- remembers static evaluations by key so a position reached again (through a transposition, in a later
+// iteration or from another picker) skips the evaluator. Direct mapped, the newest entry wins.
+// Each entry is one 64 bit word holding the upper key bits and the score, so threads share it without locks and nothing can tear.
+// Hits and misses are counted by the callers (see EvalStats in genetic.h) to keep shared counters off the probe path.
+
+class EvalCache {
+    public:
+
+    EvalCache(size_t mb = 2) {
+        resize(mb);
+    }
+
+    // Sized in megabytes, rounded down to a power of two number of entries
+    void resize(size_t mb) {
+        size_t count = 1;
+        while (count * 2 * sizeof(uint64_t) <= mb * 1024 * 1024) count *= 2;
+        table.reset(new std::atomic<uint64_t>[count]);
+        mask = count - 1;
+        clear();
+    }
+
+    void clear() {
+        for (size_t i = 0; i <= mask; i++) table[i].store(0, std::memory_order_relaxed);
+    }
+
+    bool probe(uint64_t key, int& score) {
+        uint64_t entry = table[key & mask].load(std::memory_order_relaxed);
+        if (entry == 0 || (entry >> 32) != (key >> 32)) return false;
+        score = (int32_t)(uint32_t)entry;
+        return true;
+    }
+
+    void store(uint64_t key, int score) {
+        table[key & mask].store((key & 0xFFFFFFFF00000000ULL) | (uint32_t)score, std::memory_order_relaxed);
+    }
+
+    private:
+    std::unique_ptr<std::atomic<uint64_t>[]> table;
+    size_t mask = 0;
+};
+
+#endif
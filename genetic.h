@@ -2,12 +2,128 @@
 #define GENETIC_H
 
 #include "chess.h"
+#include "tt.h"
+#include "evalcache.h"
+#include "rng.h"
 #include <map>
+#include <memory>
 #include <cmath>
 #include <climits>
 #include <cfloat>
 #include <iostream>
 #include <algorithm>
+#include <chrono>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Search scores are integer centipawns from the side to move's view. Being mated in n plies scores -(SCORE_MATE - n),
+// evaluations are clamped below SCORE_MATE_BOUND so they never look like a mate.
+const int SCORE_INFINITE = 1 << 30;
+const int SCORE_MATE = 1 << 29;
+const int SCORE_MATE_BOUND = SCORE_MATE - 512;
+
+// The features the Turochamp evaluation weights for one side, all integer counts.
+struct EvalTerms {
+    int pieces[8] = {}; // By piece bit, 2 PAWN ... 7 KING
+    int movers = 0;
+    int moves[64]; // Move counts of the pieces other than pawns and kings that can move, file by file
+    int kmobs = 0; // King moves excluding castles
+    int rbndefs = 0;
+    int qdefs = 0;
+    int kdefs = 0; // Empty squares the king sees, only counted when nothing defends it
+    bool check = false; // Gives check to the other side
+    bool mate = false; // ... and it is checkmate
+};
+
+// evaluate() weights rounded to fixed point with EVAL_SHIFT fractional bits of a centipawn. Built by ChessAI::quantize().
+struct QuantizedEval {
+    static const int EVAL_SHIFT = 8;
+    
+    uint64_t id = 0; // Hash of the weights -- mixed into evaluation cache keys so AIs with different coefficients never share entries
+    int values[8]; // Piece values in centipawns, for delta pruning
+    long long material[8];
+    long long mobtable[64]; // mob * sqrt(moves) so a piece's mobility is a single lookup
+    long long rbndef, qdef, kmob, kdef, chk, ckmt, movecount;
+};
+
+// Sibling positions in structure of arrays form for ChessAI::evaluateBatch(). Each row holds one term for every position,
+// as the difference between the side the score is for and the other side, so weighing a batch is a run of multiply-adds down the rows.
+struct EvalBatch {
+    static const int MAXN = 256; // More than the most moves any position has
+    
+    // PAWN ... KING counts, mobility (already weighted by the table), king mobility, RBN defenses, queen defenses, king sight, check, mate
+    enum { PIECES = 0, MOBILITY = 6, KMOB, RBNDEF, QDEF, KDEF, CHECK, MATE, ROWS };
+    
+    int size = 0;
+    double terms[ROWS][MAXN];
+    bool scored[MAXN]; // Already in scores[] -- found in the evaluation cache, or scored alone because evalTerms() can't handle it
+    uint64_t keys[MAXN]; // Evaluation cache keys
+    int scores[MAXN]; // Filled by evaluateBatch()
+};
+
+// Evaluation cache hits and misses. Counted by whoever evaluates (each search thread, or the AI in the pickers) rather than
+// in the shared cache so threads don't fight over the counters.
+struct EvalStats {
+    long long hits = 0;
+    long long misses = 0;
+};
+
+// How long pick() may search. Iterative deepening stops at whichever limit is hit first; 0 means no limit.
+struct SearchLimits {
+    int depth = 2; // Plies
+    double movetime = 0; // Milliseconds
+    long long nodes = 0;
+    
+    SearchLimits() {}
+    SearchLimits(int d, double ms = 0, long long n = 0) {
+        depth = d;
+        movetime = ms;
+        nodes = n;
+    }
+};
+
+// State shared by every thread of one search.
+struct SearchShared {
+    SearchLimits limits; // Of the running search -- the AI's own limits member is only the default for pick(game)
+    std::atomic<bool> stop{false};
+    std::atomic<long long> nodes{0}; // Published in steps of 64 so threads don't fight over the counter
+};
+
+// Per thread search state. Nothing in here is touched by other threads.
+struct SearchThread {
+    static const int MAXPLY = 64;
+    
+    int id = 0; // 0 is the main thread
+    long long nodecount = 0;
+    int leafcount = 0;
+    bool stopped = false; // Set when a limit runs out mid-iteration; everything after that is thrown away
+    bool canstop = false;
+    Rng rng; // Seeded by pick() from the AI's generator
+    Move pvmove; // Best move of the last finished iteration, searched first at the root
+    
+    // Triangular principal variation table -- pv[ply] is the best line found from that ply, pvlength[ply] where it ends.
+    Move pv[MAXPLY][MAXPLY];
+    int pvlength[MAXPLY] = {};
+    
+    // Result of the deepest finished iteration
+    Move best;
+    std::vector<Move> line;
+    int score = 0;
+    int depth = 0;
+    
+    // Move ordering. Killers are quiet moves that caused a cutoff at the same ply, history counts cutoffs per side and (from, to).
+    Move killers[MAXPLY][2];
+    int history[2][64][64] = {};
+    EvalStats evalstats;
+};
 
 // Genetic variation on Turochamp -- a heuristic based algorithm developed by Alan Turing. It works similarly to the heuristic Tetris algorithm in the TETRIS repo.
 
@@ -28,6 +144,8 @@ class ChessAI {
     double ckmt = 1000; // Checkmate value that replaces the check value upon the threat of a mate
     double movecount = -0.01;
     
+    Rng rng; // Breaks ties between equally good moves
+    
     ChessAI() {
         mob = 1;
         rbndef = 1;
@@ -38,9 +156,17 @@ class ChessAI {
         chk = 1;
         ckmt = 1000;
         movecount = -0.01;
+        quantize();
     }
     
     ChessAI(const ChessAI& other) {
+        *this = other;
+    }
+    
+    // Copies the coefficients and settings. The search state stays this AI's own and the transposition table is dropped
+    // (it is allocated again on first use) so two AIs never share a stop flag, node counter or table.
+    ChessAI& operator=(const ChessAI& other) {
+        if (this == &other) return *this;
         mob = other.mob;
         rbndef = other.rbndef;
         qdef = other.qdef;
@@ -50,6 +176,29 @@ class ChessAI {
         chk = other.chk;
         ckmt = other.ckmt;
         movecount = other.movecount;
+        integereval = other.integereval;
+        qeval = other.qeval;
+        evalcachemb = other.evalcachemb;
+        evalcache = other.evalcache;
+        hashmb = other.hashmb;
+        threads = other.threads;
+        rng = other.rng;
+        limits = other.limits;
+        quiescence = other.quiescence;
+        aspiration = other.aspiration;
+        qchecks = other.qchecks;
+        qdelta = other.qdelta;
+        qmaxply = other.qmaxply;
+        nullmove = other.nullmove;
+        nullreduction = other.nullreduction;
+        nullmindepth = other.nullmindepth;
+        lmr = other.lmr;
+        lmrmindepth = other.lmrmindepth;
+        lmrmoves = other.lmrmoves;
+        lmrlate = other.lmrlate;
+        lmrreduction = other.lmrreduction;
+        tt.reset();
+        return *this;
     }
     
     ChessAI(int m, int r, int q, int km, int kd, int o, int ch, int cm, int mc) {
@@ -62,9 +211,10 @@ class ChessAI {
         chk = ch;
         ckmt = cm;
         movecount = mc;
+        quantize();
     }
     
-    float getOneSidedScore(ChessGame game, bool verbose = false) {
+    float getOneSidedScore(ChessGame& game, bool verbose = false) {
         double material = 0;
         /*
         if (verbose) std::cout << "{" << game.captures.size() << "}";
@@ -75,12 +225,7 @@ class ChessAI {
         if (verbose) std::cout << "<<<\n";
         */
 
-        for (int x = 0; x < 8; x++) {
-            for (int y = 0; y < 8; y++) {
-                ChessPiece piece = game.board[x][y];
-                if (!piece.isEmpty() && piece.getColor() == game.sidetomove) material += values[piece.getID()];
-            }
-        }
+        for (int id = 2; id < 8; id++) material += values[id] * game.pieceCount(game.sidetomove ? 0 : 1, id); // Counts are kept up to date move by move
                 
         std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> legals = game.getAllLegalMoves();
         std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> defs = game.getDefenses();
@@ -97,7 +242,7 @@ class ChessAI {
         int kmobs = 0;
         for (auto p : legals) {
             ChessPiece source = game.board[p.first.first][p.first.second];
-            if (source.isKing() && abs(p.second.second) != 2) kmobs++;
+            if (source.isKing() && abs(p.second.first) != 2) kmobs++;
         }
         
         for (auto p : pmoves) mobs += std::sqrt((double)(p.second));
@@ -132,11 +277,10 @@ class ChessAI {
             }
         }
         
-        ChessGame game2(game);
-        game2.sidetomove = !game.sidetomove;
-        
-        int checks = (game2.noChecks()) ? 0 : 1;
-        if (game2.checkmate()) checks = ckmt;
+        game.sidetomove = !game.sidetomove;
+        int checks = (game.noChecks()) ? 0 : 1;
+        if (game.checkmate()) checks = ckmt;
+        game.sidetomove = !game.sidetomove;
         
         int oos = 0;
         
@@ -147,35 +291,305 @@ class ChessAI {
         return material + mobs * mob + kmob * kmobs + rbndef * rbndefs + qdef * qdefs + kdef * kdefs + chk * checks - movecnt * movecount;
     }
 
-    double getScore(ChessGame game, bool verbose = false) {
+    // The terms getOneSidedScore() weights for one side (0 WHITE, 1 BLACK), straight from the bitboards -- no move lists, no getDefenses(),
+    // and the mate test only runs when a side is in check. False if the side does not have exactly one king.
+    bool evalTerms(ChessGame& game, int c, EvalTerms& t) {
+        bool white = (c == 0);
+        uint64_t own = game.bitboards[c];
+        uint64_t occ = game.occupancy();
+        
+        for (int id = 2; id < 8; id++) t.pieces[id] = game.pieceCount(c, id);
+        
+        int counts[64];
+        if (!game.mobility(white, counts, t.kmobs)) return false;
+        
+        uint64_t movers = own & (game.bitboards[3] | game.bitboards[4] | game.bitboards[5] | game.bitboards[6]);
+        for (int x = 0; x < 8; x++) { // File by file like the std::map in getOneSidedScore()
+            for (int y = 0; y < 8; y++) {
+                int sq = Bitboards::square(x, y);
+                if ((movers & Bitboards::bit(sq)) && counts[sq] > 0) t.moves[t.movers++] = counts[sq];
+            }
+        }
+        
+        // Defenses -- how many of our own pieces could recapture on each of our pieces. Sliders see through the enemy.
+        int kdefcnt = 0;
+        uint64_t defended = own & ~game.bitboards[2];
+        while (defended) {
+            int sq = Bitboards::poplsb(defended);
+            uint64_t defenders = (Bitboards::pawnAttacks(1 - c, sq) & game.bitboards[2]) | (Bitboards::knightAttacks(sq) & game.bitboards[3]) | (Bitboards::kingAttacks(sq) & game.bitboards[7]);
+            defenders |= Bitboards::bishopAttacks(sq, own) & (game.bitboards[4] | game.bitboards[6]);
+            defenders |= Bitboards::rookAttacks(sq, own) & (game.bitboards[5] | game.bitboards[6]);
+            int n = Bitboards::popcount(defenders & own);
+            int id = game.board[sq % 8][sq / 8].getID();
+            if (id >= 3 && id <= 5) t.rbndefs += n;
+            if (id == 6) t.qdefs += n;
+            if (id == 7) kdefcnt += n;
+        }
+        
+        if (kdefcnt == 0) {
+            uint64_t kings = own & game.bitboards[7];
+            while (kings) t.kdefs += Bitboards::popcount(Bitboards::queenAttacks(Bitboards::poplsb(kings), occ) & ~occ);
+        }
+        
+        t.check = game.inCheck(!white);
+        if (t.check) {
+            bool side = game.sidetomove;
+            game.sidetomove = !white;
+            MoveList replies;
+            game.generateMoves(replies);
+            t.mate = replies.empty();
+            game.sidetomove = side;
+        }
+        return true;
+    }
+    
+    // getOneSidedScore() for both sides at once from evalTerms(). Every term is summed in the same order as getOneSidedScore() so the result is bit for bit the same.
+    double evaluate(ChessGame& game) {
+        float sides[2];
+        for (int c = 0; c < 2; c++) {
+            EvalTerms t;
+            if (!evalTerms(game, c, t)) return getScore(game, false, false); // No king or several -- take the long way
+            
+            double material = 0;
+            for (int id = 2; id < 8; id++) material += values[id] * t.pieces[id];
+            
+            double mobs = 0;
+            for (int i = 0; i < t.movers; i++) mobs += std::sqrt((double)(t.moves[i]));
+            
+            int checks = t.mate ? (int)ckmt : (t.check ? 1 : 0);
+            int movecnt = game.halfmoveclock;
+            
+            sides[c] = material + mobs * mob + kmob * t.kmobs + rbndef * t.rbndefs + qdef * t.qdefs + kdef * t.kdefs + chk * checks - movecnt * movecount;
+        }
+        
+        double res = sides[game.sidetomove ? 0 : 1];
+        res -= sides[game.sidetomove ? 1 : 0];
+        return res;
+    }
+    
+    // Integer evaluation mode. The coefficients are rounded to fixed point once per search (quantize() is called by pick()),
+    // after that evaluateCp() is integer arithmetic and table lookups only. Call quantize() again after changing coefficients outside of pick().
+    bool integereval = true; // Search with evaluateCp(), otherwise with evaluate() rounded to centipawns
+    QuantizedEval qeval;
+    
+    void quantize() {
+        auto q = [](double x) { return (long long)std::llround(x * 100 * (1 << QuantizedEval::EVAL_SHIFT)); };
+        for (int id = 0; id < 8; id++) {
+            qeval.values[id] = (int)std::llround(values[id] * 100);
+            qeval.material[id] = q(values[id]);
+        }
+        for (int n = 0; n < 64; n++) qeval.mobtable[n] = q(mob * std::sqrt((double)n));
+        qeval.rbndef = q(rbndef);
+        qeval.qdef = q(qdef);
+        qeval.kmob = q(kmob);
+        qeval.kdef = q(kdef);
+        qeval.chk = q(chk);
+        qeval.ckmt = q(chk * (int)ckmt);
+        qeval.movecount = q(movecount);
+        
+        uint64_t h = 0;
+        auto add = [&h](long long x) { h ^= (uint64_t)x; h = Rng::mix(h); };
+        for (int id = 0; id < 8; id++) add(qeval.material[id]);
+        for (int n = 0; n < 64; n++) add(qeval.mobtable[n]);
+        for (long long x : {qeval.rbndef, qeval.qdef, qeval.kmob, qeval.kdef, qeval.chk, qeval.ckmt, qeval.movecount}) add(x);
+        qeval.id = h;
+    }
+    
+    // Evaluation cache for evaluateCp(), allocated on first use like the transposition table. Copies share it, since the keys
+    // include the coefficient set. Off (0 megabytes) by default: inside pick() the transposition table already catches most
+    // repeated positions and the extra memory access costs more than the few hits save. The pickdepth1/pickdepth2 pickers
+    // re-evaluate a lot more and run faster with it on.
+    size_t evalcachemb = 0;
+    std::shared_ptr<EvalCache> evalcache;
+    EvalStats evalstats; // This AI's cache hits and misses so far, pick() adds its threads' counts after the search
+    
+    void setEvalCache(size_t mb) {
+        evalcachemb = mb;
+        if (mb == 0) evalcache.reset();
+        else if (evalcache) evalcache->resize(mb);
+        else evalcache = std::make_shared<EvalCache>(mb);
+    }
+    
+    void initEvalCache() {
+        if (!evalcache && evalcachemb > 0) evalcache = std::make_shared<EvalCache>(evalcachemb);
+    }
+    
+    // Cache key of the position scored for color us (0 WHITE, 1 BLACK) with the current coefficients
+    uint64_t evalKey(ChessGame& game, int us) {
+        return ((us == 0) ? game.hash : (game.hash ^ Zobrist::keys().side)) ^ qeval.id;
+    }
+    
+    long long weigh(EvalTerms& t, int movecnt) {
+        const QuantizedEval& q = qeval;
+        long long res = 0;
+        for (int id = 2; id < 8; id++) res += q.material[id] * t.pieces[id];
+        for (int i = 0; i < t.movers; i++) res += q.mobtable[t.moves[i]];
+        res += q.kmob * t.kmobs + q.rbndef * t.rbndefs + q.qdef * t.qdefs + q.kdef * t.kdefs;
+        res += t.mate ? q.ckmt : (t.check ? q.chk : 0);
+        return res - q.movecount * movecnt;
+    }
+    
+    static int clampEval(long long cp) {
+        return (int)std::max((long long)-SCORE_MATE_BOUND + 1, std::min((long long)SCORE_MATE_BOUND - 1, cp));
+    }
+    
+    bool probeEval(uint64_t key, int& score, EvalStats& stats) {
+        if (!evalcache) return false;
+        bool hit = evalcache->probe(key, score);
+        if (hit) stats.hits++;
+        else stats.misses++;
+        return hit;
+    }
+    
+    // evaluate() in integer centipawns from the side to move's view
+    int evaluateCp(ChessGame& game, EvalStats& stats) {
+        int us = game.sidetomove ? 0 : 1;
+        uint64_t key = evalKey(game, us);
+        int res;
+        if (probeEval(key, res, stats)) return res;
+        
+        EvalTerms t[2];
+        if (!evalTerms(game, 0, t[0]) || !evalTerms(game, 1, t[1])) return clampEval(std::llround(getScore(game, false, false) * 100)); // Not cached, it depends on more than the key
+        long long sum = weigh(t[us], game.halfmoveclock) - weigh(t[1 - us], game.halfmoveclock); // The halfmove terms cancel
+        res = clampEval((sum + (1 << (QuantizedEval::EVAL_SHIFT - 1))) >> QuantizedEval::EVAL_SHIFT);
+        if (evalcache) evalcache->store(key, res);
+        return res;
+    }
+    
+    int evaluateCp(ChessGame& game) {
+        return evaluateCp(game, evalstats);
+    }
+    
+    // Leaf score for the search
+    int evaluateLeaf(ChessGame& game, EvalStats& stats) {
+        if (integereval) return evaluateCp(game, stats);
+        return clampEval(std::llround(evaluate(game) * 100));
+    }
+    
+    // Adds a position to the batch, to be scored for color us (0 WHITE, 1 BLACK). The terms are still gathered one position at a time.
+    void batchAdd(EvalBatch& batch, ChessGame& game, int us, EvalStats& stats) {
+        int i = batch.size++;
+        batch.keys[i] = evalKey(game, us);
+        batch.scored[i] = probeEval(batch.keys[i], batch.scores[i], stats);
+        EvalTerms t[2];
+        if (!batch.scored[i] && (!evalTerms(game, 0, t[0]) || !evalTerms(game, 1, t[1]))) { // No king or several -- take the long way
+            bool side = game.sidetomove;
+            game.sidetomove = (us == 0);
+            batch.scores[i] = clampEval(std::llround(getScore(game, false, false) * 100));
+            game.sidetomove = side;
+            batch.scored[i] = true;
+        }
+        if (batch.scored[i]) {
+            for (int r = 0; r < EvalBatch::ROWS; r++) batch.terms[r][i] = 0;
+            return;
+        }
+        
+        EvalTerms& a = t[us];
+        EvalTerms& b = t[1 - us];
+        long long mobs = 0;
+        for (int j = 0; j < a.movers; j++) mobs += qeval.mobtable[a.moves[j]];
+        for (int j = 0; j < b.movers; j++) mobs -= qeval.mobtable[b.moves[j]];
+        for (int id = 2; id < 8; id++) batch.terms[EvalBatch::PIECES + id - 2][i] = a.pieces[id] - b.pieces[id];
+        batch.terms[EvalBatch::MOBILITY][i] = (double)mobs;
+        batch.terms[EvalBatch::KMOB][i] = a.kmobs - b.kmobs;
+        batch.terms[EvalBatch::RBNDEF][i] = a.rbndefs - b.rbndefs;
+        batch.terms[EvalBatch::QDEF][i] = a.qdefs - b.qdefs;
+        batch.terms[EvalBatch::KDEF][i] = a.kdefs - b.kdefs;
+        batch.terms[EvalBatch::CHECK][i] = (a.check && !a.mate) - (b.check && !b.mate);
+        batch.terms[EvalBatch::MATE][i] = a.mate - b.mate;
+    }
+    
+    // Scores every position in the batch with the quantized weights, four at a time with AVX2, two with SSE2, otherwise one by one.
+    // The halfmove terms cancel between the sides. Terms and weights are integers whose products and sums stay far inside a double's
+    // 53 bit mantissa, so the scores are exactly evaluateCp()'s.
+    void evaluateBatch(EvalBatch& batch) {
+        const QuantizedEval& q = qeval;
+        double weights[EvalBatch::ROWS] = {(double)q.material[2], (double)q.material[3], (double)q.material[4], (double)q.material[5], (double)q.material[6], (double)q.material[7],
+                                           1, (double)q.kmob, (double)q.rbndef, (double)q.qdef, (double)q.kdef, (double)q.chk, (double)q.ckmt};
+        double sums[EvalBatch::MAXN];
+        int i = 0;
+#if defined(__AVX2__)
+        for (; i + 4 <= batch.size; i += 4) {
+            __m256d acc = _mm256_setzero_pd();
+            for (int r = 0; r < EvalBatch::ROWS; r++) acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_set1_pd(weights[r]), _mm256_loadu_pd(&batch.terms[r][i])));
+            _mm256_storeu_pd(&sums[i], acc);
+        }
+#endif
+#if defined(__SSE2__)
+        for (; i + 2 <= batch.size; i += 2) {
+            __m128d acc = _mm_setzero_pd();
+            for (int r = 0; r < EvalBatch::ROWS; r++) acc = _mm_add_pd(acc, _mm_mul_pd(_mm_set1_pd(weights[r]), _mm_loadu_pd(&batch.terms[r][i])));
+            _mm_storeu_pd(&sums[i], acc);
+        }
+#endif
+        for (; i < batch.size; i++) {
+            double acc = 0;
+            for (int r = 0; r < EvalBatch::ROWS; r++) acc += weights[r] * batch.terms[r][i];
+            sums[i] = acc;
+        }
+        
+        for (i = 0; i < batch.size; i++) {
+            if (batch.scored[i]) continue;
+            long long res = (long long)sums[i];
+            batch.scores[i] = clampEval((res + (1 << (QuantizedEval::EVAL_SHIFT - 1))) >> QuantizedEval::EVAL_SHIFT);
+            if (evalcache) evalcache->store(batch.keys[i], batch.scores[i]);
+        }
+    }
+
+    // fast uses evaluate(), otherwise (or when verbose) both sides go through getOneSidedScore().
+    double getScore(ChessGame& game, bool verbose = false, bool fast = true) {
+        if (fast && !verbose) return evaluate(game);
         double res = getOneSidedScore(game, verbose);
-        ChessGame game2(game);
-        game2.sidetomove = !game2.sidetomove;
-        res -= getOneSidedScore(game2, verbose);
+        game.sidetomove = !game.sidetomove;
+        res -= getOneSidedScore(game, verbose);
+        game.sidetomove = !game.sidetomove;
         return res;
     }
     
 	// Maximizes your score after moving (opponent can do stuff later to lower it however)
-    std::pair<std::pair<int, int>, std::pair<int, int>> pickdepth1(ChessGame game, bool verbose = false) {
-        std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> legals = game.getAllLegalMoves();
-        if (legals.size() == 0) return {std::make_pair(-1, -1), std::make_pair(0, 0)};
+    Move pickdepth1(ChessGame& game, bool verbose = false) {
+        MoveList legals;
+        game.generateMoves(legals);
+        if (legals.size() == 0) return Move();
         
-        std::pair<std::pair<int, int>, std::pair<int, int>> res = legals[0];
+        // Integer mode scores all the moves as one batch
+        EvalBatch batch;
+        bool batched = integereval && !verbose;
+        if (batched) {
+            quantize(); // Weigh with the current coefficients, they may have changed since the last pick()
+            initEvalCache();
+            int us = game.sidetomove ? 0 : 1;
+            for (auto p : legals) {
+                ChessGame::UndoInfo undo = game.makeMove(p);
+                batchAdd(batch, game, us, evalstats);
+                game.unmakeMove(p, undo);
+            }
+            evaluateBatch(batch);
+        }
+        
+        Move res = legals[0];
         double maxscore = -1 * DBL_MAX;
-        for (auto p : legals) {
+        for (int i = 0; i < legals.size(); i++) {
             leafcount++;
-            if (verbose) std::cout << "[" << p.first.first << " " << p.first.second << " > " << p.second.first << " " << p.second.second << "]\n";
-            ChessGame game2(game);
-            game2.execute(p.first, p.second);
-            if (verbose) for (auto i : game2.captures) std::cout << i.toString() << " ";
-            if (verbose) std::cout << "---\n";
-            double score = getScore(game2, verbose);
+            Move p = legals[i];
+            double score;
+            if (batched) score = batch.scores[i];
+            else {
+                if (verbose) std::cout << "[" << p.toString() << "]\n";
+                ChessGame::UndoInfo undo = game.makeMove(p);
+                game.sidetomove = !game.sidetomove; // Score from our side
+                if (verbose) for (auto i : game.captures) std::cout << i.toString() << " ";
+                if (verbose) std::cout << "---\n";
+                score = getScore(game, verbose);
+                game.sidetomove = !game.sidetomove;
+                game.unmakeMove(p, undo);
+            }
             if (score > maxscore) {
                 maxscore = score;
                 res = p;
             }
             if (score == maxscore) {
-                if (rand() % 2 == 0) {
+                if (rng.coin()) {
                     maxscore = score;
                     res = p;
                 }
@@ -185,31 +599,50 @@ class ChessAI {
     }
 
 	// Minimizes the score of the opponent after moving
-	std::pair<std::pair<int, int>, std::pair<int, int>> minoppd1(ChessGame game, bool verbose = false, int maxcons = 32) {
-        std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> legals = game.getAllLegalMoves();
-        if (legals.size() == 0) return {std::make_pair(-1, -1), std::make_pair(0, 0)};
+	Move minoppd1(ChessGame& game, bool verbose = false, int maxcons = 32) {
+        MoveList legals;
+        game.generateMoves(legals);
+        if (legals.size() == 0) return Move();
         
-        std::pair<std::pair<int, int>, std::pair<int, int>> res = legals[0];
+        Move res = legals[0];
         double maxscore = DBL_MAX;
         
-        std::random_shuffle(legals.begin(), legals.end());
+        rng.shuffle(legals.begin(), legals.end());
+        
+        // Integer mode scores the considered moves as one batch, from the opponent's side
+        EvalBatch batch;
+        bool batched = integereval && !verbose;
+        if (batched) {
+            quantize(); // Weigh with the current coefficients, they may have changed since the last pick()
+            initEvalCache();
+            int opp = game.sidetomove ? 1 : 0;
+            for (int i = 0; i < maxcons && i < legals.size(); i++) {
+                ChessGame::UndoInfo undo = game.makeMove(legals[i]);
+                batchAdd(batch, game, opp, evalstats);
+                game.unmakeMove(legals[i], undo);
+            }
+            evaluateBatch(batch);
+        }
         
         for (int i = 0; i < maxcons && i < legals.size(); i++) {
             leafcount++;
             auto p = legals[i];
-            if (verbose) std::cout << "[" << p.first.first << " " << p.first.second << " > " << p.second.first << " " << p.second.second << "]\n";
-            ChessGame game2(game);
-            game2.execute(p.first, p.second);
-            if (verbose) for (auto i : game2.captures) std::cout << i.toString() << " ";
-            if (verbose) std::cout << "---\n";
-			game2.sidetomove = !game2.sidetomove;
-            double score = getScore(game2, verbose);
+            double score;
+            if (batched) score = batch.scores[i];
+            else {
+                if (verbose) std::cout << "[" << p.toString() << "]\n";
+                ChessGame::UndoInfo undo = game.makeMove(p);
+                if (verbose) for (auto i : game.captures) std::cout << i.toString() << " ";
+                if (verbose) std::cout << "---\n";
+                score = getScore(game, verbose);
+                game.unmakeMove(p, undo);
+            }
             if (score < maxscore) {
                 maxscore = score;
                 res = p;
             }
             if (score == maxscore) {
-                if (rand() % 2 == 0) {
+                if (rng.coin()) {
                     maxscore = score;
                     res = p;
                 }
@@ -220,16 +653,17 @@ class ChessAI {
 
 	// Minimaxes the opponent's response (so basically it picks the move such that if the opponent responds in a way that gives you the worst outcome this worst outcome is lessened).
 
-	std::pair<std::pair<int, int>, std::pair<int, int>> pickdepth2(ChessGame game, bool verbose = false, int maxcons = 32) {
-		std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> legals = game.getAllLegalMoves();
+	Move pickdepth2(ChessGame& game, bool verbose = false, int maxcons = 32) {
+		MoveList legals;
+		game.generateMoves(legals);
 		// for (auto i : legals) std::cout << "[" << i.first.first << " " << i.first.second << " " << i.second.first << " " << i.second.second << "]";
 		// std::cout << "\n";
         if (legals.size() <= 0) {
             // std::cout << "PICK FAILED\n";
-            return {std::make_pair(-1, -1), std::make_pair(0, 0)};
+            return Move();
         }
         
-        std::pair<std::pair<int, int>, std::pair<int, int>> res = legals[0];
+        Move res = legals[0];
         double maxscore = -1 * DBL_MAX;
 
 		int x = 0;
@@ -239,20 +673,26 @@ class ChessAI {
 		// std::random_shuffle(legals.begin(), legals.end());
 		for (int i = 0; i < legals.size() && i < maxcons; i++) {
 		    // std::cout << i << " ";
-			ChessGame game2(game);
-			game2.execute(legals[i].first, legals[i].second);
-			game2.sidetomove = !game2.sidetomove;
-			auto oppmove = minoppd1(game2, verbose);
-			game2.execute(oppmove.first, oppmove.second);
-			game2.sidetomove = !game2.sidetomove;
-
-			double score = getScore(game2, verbose);
+			ChessGame::UndoInfo undo = game.makeMove(legals[i]);
+			auto oppmove = minoppd1(game, verbose);
+			double score;
+			if (oppmove.isNull()) { // Opponent has no reply
+				game.sidetomove = !game.sidetomove;
+				score = getScore(game, verbose);
+				game.sidetomove = !game.sidetomove;
+			}
+			else {
+				ChessGame::UndoInfo oppundo = game.makeMove(oppmove);
+				score = getScore(game, verbose);
+				game.unmakeMove(oppmove, oppundo);
+			}
+			game.unmakeMove(legals[i], undo);
 			if (score >= maxscore) {
 				maxscore = score;
-				res = std::make_pair(legals[i].first, legals[i].second);
+				res = legals[i];
 			}
 			if (score == maxscore) {
-				if (rand() % 2 == 0) res = std::make_pair(legals[i].first, legals[i].second);
+				if (rng.coin()) res = legals[i];
 			}
 		}
 		
@@ -260,78 +700,377 @@ class ChessAI {
 		return res;
 	}
 
-    std::pair<std::pair<int, int>, std::pair<int, int>> chosenmove = {{0, 0}, {0, 0}};
-
     int leafcount = 0;
+    
+    // Search control for iterative deepening
+    SearchLimits limits; // Used by pick(game)
+    long long nodecount = 0; // Nodes of the last pick() over all threads
+    std::chrono::steady_clock::time_point searchstart;
+    std::shared_ptr<SearchShared> shared = std::make_shared<SearchShared>(); // Copies get their own
+    
+    double elapsed() { // Milliseconds since the search started
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - searchstart).count();
+    }
+    
+    bool outOfBudget() {
+        SearchLimits& lim = shared->limits;
+        if (lim.nodes > 0 && shared->nodes.load(std::memory_order_relaxed) >= lim.nodes) return true;
+        return lim.movetime > 0 && elapsed() >= lim.movetime;
+    }
+    
+    // Ends a running pick() from another thread. It still returns the best move of the deepest finished iteration.
+    void stop() {
+        shared->stop = true;
+    }
+    
+    // Called at every node. Every 64 nodes the thread publishes its count and looks at the stop flag and the budget.
+    bool checkStop(SearchThread& st) {
+        if (st.stopped) return true;
+        st.nodecount++;
+        if ((st.nodecount & 63) != 0) return false;
+        shared->nodes.fetch_add(64, std::memory_order_relaxed);
+        if (!st.canstop) return false;
+        if (shared->stop || outOfBudget()) {
+            shared->stop = true;
+            st.stopped = true;
+        }
+        return st.stopped;
+    }
+    
+    // Transposition table. Each AI gets its own (copies start without one) and it is allocated on first use.
+    // All search threads share it without locks -- see tt.h.
+    size_t hashmb = 16;
+    std::shared_ptr<TranspositionTable> tt;
+    
+    void setHash(size_t mb) {
+        hashmb = mb;
+        if (tt) tt->resize(mb);
+        else tt = std::make_shared<TranspositionTable>(mb);
+    }
+    
+    // Lazy SMP -- this many threads search the same root and only share the transposition table.
+    int threads = 1;
+    
+    // Called on the main search thread after every finished iteration with the depth, score and principal variation (the UCI front-end prints info lines from it).
+    std::function<void(int, int, const std::vector<Move>&)> onIteration;
+    
+    // Scores are from the side to move's view, the same as in the table. alpha and beta are the window the node was searched with.
+    // Mate scores count plies from the root, the table keeps them relative to the stored position so they stay right after a transposition.
+    void ttStore(ChessGame& game, int res, Move best, int remlayers, int alpha, int beta, int ply) {
+        int bound = (res <= alpha) ? BOUND_UPPER : ((res >= beta) ? BOUND_LOWER : BOUND_EXACT);
+        int stored = (res >= SCORE_MATE_BOUND) ? res + ply : ((res <= -SCORE_MATE_BOUND) ? res - ply : res);
+        tt->store(game.key(), stored, best, remlayers, bound);
+    }
+    
+    static int ttScore(int score, int ply) {
+        return (score >= SCORE_MATE_BOUND) ? score - ply : ((score <= -SCORE_MATE_BOUND) ? score + ply : score);
+    }
 
-    double abprune(ChessGame game, int remlayers, double alpha, double beta, bool isMaximizing) { // remlayers must start (outermost call) at an even number
-        if (remlayers <= 0) {
-            leafcount++;
-            return getScore(game);
+    // Move ordering. Alpha-beta cuts off sooner the earlier the best move is tried.
+    // Hash/PV move, then captures and promotions by MVV-LVA (most valuable victim, least valuable attacker), then killers, then history.
+    int moveRank(SearchThread& st, ChessGame& game, Move m, Move first, int ply) {
+        if (m == first) return 1 << 30;
+        std::pair<int, int> src = m.src();
+        std::pair<int, int> des = {m.to() % 8, m.to() / 8};
+        int victim = (m.isEnPassant()) ? 2 : (game.board[des.first][des.second].isEmpty() ? 0 : game.board[des.first][des.second].getID());
+        if (victim || m.isPromotion()) return (1 << 24) + 8 * (victim + (m.isPromotion() ? m.promotion() : 0)) - game.board[src.first][src.second].getID();
+        if (ply < SearchThread::MAXPLY && m == st.killers[ply][0]) return (1 << 23) + 1;
+        if (ply < SearchThread::MAXPLY && m == st.killers[ply][1]) return 1 << 23;
+        return std::min(st.history[game.sidetomove ? 0 : 1][m.from()][m.to()], (1 << 23) - 1);
+    }
+    
+    // Sorts best first. The list is shuffled beforehand and the sort is stable so only equally ranked moves come out in random order.
+    void orderMoves(SearchThread& st, ChessGame& game, MoveList& legals, Move first, int ply) {
+        st.rng.shuffle(legals.begin(), legals.end());
+        int ranks[256];
+        for (int i = 0; i < legals.size(); i++) ranks[i] = moveRank(st, game, legals[i], first, ply);
+        for (int i = 1; i < legals.size(); i++) { // Insertion sort -- lists are short
+            Move m = legals[i];
+            int r = ranks[i];
+            int j = i - 1;
+            for (; j >= 0 && ranks[j] < r; j--) {
+                legals.moves[j + 1] = legals[j];
+                ranks[j + 1] = ranks[j];
+            }
+            legals.moves[j + 1] = m;
+            ranks[j + 1] = r;
+        }
+    }
+    
+    // Neither a capture nor a promotion
+    bool isQuiet(ChessGame& game, Move m) {
+        return !m.isEnPassant() && !m.isPromotion() && game.board[m.to() % 8][m.to() / 8].isEmpty();
+    }
+    
+    // A quiet move refuted the opponent's last move here, so try it early in sibling positions too.
+    void recordCutoff(SearchThread& st, ChessGame& game, Move m, int remlayers, int ply) {
+        if (!isQuiet(game, m)) return;
+        if (ply < SearchThread::MAXPLY && st.killers[ply][0] != m) {
+            st.killers[ply][1] = st.killers[ply][0];
+            st.killers[ply][0] = m;
+        }
+        int& h = st.history[game.sidetomove ? 0 : 1][m.from()][m.to()];
+        h += remlayers * remlayers;
+        if (h >= (1 << 20)) { // Keep the counts bounded and let newer cutoffs matter more
+            for (int c = 0; c < 2; c++) for (int i = 0; i < 64; i++) for (int j = 0; j < 64; j++) st.history[c][i][j] /= 2;
         }
+    }
 
-        if (isMaximizing) {
-            double res = -1 * DBL_MAX;
-            std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> legals = game.getAllLegalMoves();
-            std::random_shuffle(legals.begin(), legals.end());
-            for (auto p : legals) {
-                ChessGame game2(game);
-                game2.execute(p.first, p.second);
-
-                game2.sidetomove = !game2.sidetomove;
-                double value = abprune(game2, remlayers - 1, alpha, beta, false);
-                if (value > res) {
-                    chosenmove = p;
-                    res = value;
-                }
-                if (value == res && rand() % 2 == 0) {
-                    chosenmove = p;
-                    res = value;
-                }
-                alpha = std::max(alpha, res);
-                if (beta <= alpha) break;
+    // Quiescence search -- at the horizon keep playing captures until the position is quiet so pieces are not left hanging.
+    bool quiescence = true;
+    bool qchecks = true; // Also search every reply when in check instead of standing pat
+    int qdelta = 200; // Delta pruning -- skip captures that cannot raise the score to alpha even with this many centipawns to spare
+    int qmaxply = 8; // Captures searched past the horizon at most
+
+    // Negamax with scores from the side to move's view. Standing pat (not capturing) is always an option except in check.
+    int quiesce(SearchThread& st, ChessGame& game, int alpha, int beta, int ply, int qply = 0) {
+        if (ply < SearchThread::MAXPLY) st.pvlength[ply] = ply;
+        if (checkStop(st)) return 0;
+        
+        bool evading = qchecks && qply < qmaxply && game.inCheck(game.sidetomove);
+        int res = -SCORE_MATE + ply; // Mated unless a move or standing pat does better
+        int standpat = 0;
+        if (!evading) {
+            st.leafcount++;
+            standpat = res = evaluateLeaf(game, st.evalstats);
+            if (res >= beta || qply >= qmaxply) return res;
+            alpha = std::max(alpha, res);
+        }
+        
+        MoveList moves;
+        game.generateMoves(moves, !evading);
+        orderMoves(st, game, moves, Move(), ply);
+        
+        for (auto p : moves) {
+            if (!evading && !p.isPromotion()) {
+                std::pair<int, int> des = {p.to() % 8, p.to() / 8};
+                int victim = (p.isEnPassant()) ? 2 : game.board[des.first][des.second].getID();
+                if (standpat + qeval.values[victim] + qdelta <= alpha) continue;
             }
+            ChessGame::UndoInfo undo = game.makeMove(p);
+            int value = -quiesce(st, game, -beta, -alpha, ply + 1, qply + 1);
+            game.unmakeMove(p, undo);
+            if (st.stopped) return 0;
+            res = std::max(res, value);
+            alpha = std::max(alpha, res);
+            if (alpha >= beta) break;
+        }
+        return res;
+    }
+
+    // Aspiration windows -- each iteration after the first few starts with a window this wide (in centipawns) around the last score
+    // and widens it on a fail high or low. 0 searches every iteration with the full window.
+    int aspiration = 50;
 
+    // Null move pruning -- if passing the turn and searching nullreduction plies shallower still beats beta, a real move would too.
+    // Only tried with at least nullmindepth plies left, never twice in a row, in check or with nothing but pawns (zugzwang).
+    bool nullmove = true;
+    int nullreduction = 2;
+    int nullmindepth = 3;
+    
+    // Late move reductions -- quiet moves after the first lmrmoves are searched lmrreduction plies shallower (one more past lmrlate).
+    // A reduced move that beats alpha is searched again at full depth. Not used in check, for moves that give check or near the horizon.
+    bool lmr = true;
+    int lmrmindepth = 3;
+    int lmrmoves = 3;
+    int lmrlate = 12;
+    int lmrreduction = 1;
+    
+    // Principal variation search in negamax form -- scores are from the side to move's view.
+    // The first move gets the full window. The rest only have to be shown no better than it with a zero window and are
+    // searched again with the full window if one turns out better. The best line is collected in st.pv.
+    int abprune(SearchThread& st, ChessGame& game, int remlayers, int alpha, int beta, int ply = 0, bool allownull = true) {
+        if (ply < SearchThread::MAXPLY) st.pvlength[ply] = ply;
+        if (checkStop(st)) return 0;
+        
+        // Nodes searched with an open window are on the principal variation. They never stop at the table,
+        // so the line below them is searched again and ends up in st.pv.
+        bool pvnode = ((long long)beta - alpha > 1); // The full window is wider than an int
+        TTResult hit;
+        bool found = tt->probe(game.key(), hit);
+        if (found && ply > 0 && !pvnode && hit.depth >= remlayers) {
+            int score = ttScore(hit.score, ply);
+            if (hit.bound == BOUND_EXACT) return score;
+            if (hit.bound == BOUND_LOWER && score >= beta) return score;
+            if (hit.bound == BOUND_UPPER && score <= alpha) return score;
+        }
+        
+        if (remlayers <= 0) {
+            int res;
+            if (quiescence) res = quiesce(st, game, alpha, beta, ply);
+            else {
+                st.leafcount++;
+                res = evaluateLeaf(game, st.evalstats);
+            }
+            if (st.stopped) return 0;
+            ttStore(game, res, Move(), 0, alpha, beta, ply);
             return res;
-            
         }
+        
+        bool incheck = game.inCheck(game.sidetomove);
+        int you = game.sidetomove ? 0 : 1;
+        bool pieces = game.pieceCount(you, 3) + game.pieceCount(you, 4) + game.pieceCount(you, 5) + game.pieceCount(you, 6) > 0;
+        if (nullmove && allownull && ply > 0 && remlayers >= nullmindepth && beta < SCORE_MATE_BOUND && !incheck && pieces) {
+            ChessGame::UndoInfo undo = game.makeNullMove();
+            int value = -abprune(st, game, remlayers - 1 - nullreduction, -beta, -beta + 1, ply + 1, false);
+            game.unmakeNullMove(undo);
+            if (st.stopped) return 0;
+            if (value >= beta) return (value >= SCORE_MATE_BOUND) ? beta : value; // Don't claim a mate found by passing
+        }
+        
+        int alpha0 = alpha;
+        Move best;
+        
+        MoveList legals;
+        game.generateMoves(legals);
+        orderMoves(st, game, legals, (ply == 0 && !st.pvmove.isNull()) ? st.pvmove : (found ? hit.move : Move()), ply);
 
-        else {
-            double res = DBL_MAX;
-            std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> legals = game.getAllLegalMoves();
-            std::random_shuffle(legals.begin(), legals.end());
-            for (auto p : legals) {
-                ChessGame game2(game);
-                game2.execute(p.first, p.second);
-                game2.sidetomove = !game2.sidetomove;
-
-                double value = abprune(game2, remlayers - 1, alpha, beta, true);
-                if (value < res) {
-                    res = value;
-                    // chosenmove = p;
+        if (legals.empty()) return incheck ? -SCORE_MATE + ply : 0; // Checkmate, or stalemate which is a draw
+        
+        int res = -SCORE_INFINITE;
+        for (int i = 0; i < legals.size(); i++) {
+            Move p = legals[i];
+            bool quiet = isQuiet(game, p);
+            ChessGame::UndoInfo undo = game.makeMove(p);
+            int value;
+            if (i == 0) value = -abprune(st, game, remlayers - 1, -beta, -alpha, ply + 1);
+            else {
+                int r = 0;
+                if (lmr && quiet && i >= lmrmoves && remlayers >= lmrmindepth && !incheck && !game.inCheck(game.sidetomove)) {
+                    r = lmrreduction + (i >= lmrlate ? 1 : 0);
+                    r = std::max(0, std::min(r, remlayers - 2));
                 }
-                if (value == res && rand() % 2 == 0) {
-                    // chosenmove = p;
-                    res = value;
+                value = -abprune(st, game, remlayers - 1 - r, -alpha - 1, -alpha, ply + 1);
+                if (r > 0 && value > alpha && !st.stopped) value = -abprune(st, game, remlayers - 1, -alpha - 1, -alpha, ply + 1);
+                if (value > alpha && value < beta && !st.stopped) value = -abprune(st, game, remlayers - 1, -beta, -alpha, ply + 1);
+            }
+            game.unmakeMove(p, undo);
+            if (st.stopped) return 0;
+            
+            if (value > res || best.isNull()) {
+                res = value;
+                best = p;
+            }
+            if (value > alpha) {
+                alpha = value;
+                if (ply + 1 < SearchThread::MAXPLY) { // This move followed by the child's line
+                    st.pv[ply][ply] = p;
+                    for (int j = ply + 1; j < st.pvlength[ply + 1]; j++) st.pv[ply][j] = st.pv[ply + 1][j];
+                    st.pvlength[ply] = std::max(st.pvlength[ply + 1], ply + 1);
                 }
-                beta = std::min(beta, res);
-                if (beta <= alpha) break;
             }
-            return res;
+            if (alpha >= beta) {
+                recordCutoff(st, game, p, remlayers, ply);
+                break;
+            }
         }
-        return -1;
-
-
+        
+        ttStore(game, res, best, remlayers, alpha0, beta, ply);
+        return res;
     }
 
-	std::pair<std::pair<int, int>, std::pair<int, int>> pick(ChessGame game, bool verbose = false) {
+	Move pick(ChessGame game, bool verbose = false) {
 	    // return pickdepth2(game, false);
-
+	    return pick(game, limits, verbose);
+	}
+	
+	// Iterative deepening on one thread -- searches depth 1, 2, ... until a limit runs out or another thread says stop.
+	// Helper threads (id > 0) skip ahead a ply on every other thread so they fill the table with different subtrees.
+	void iterate(SearchThread& st, ChessGame game, Move first, int maxdepth, bool verbose) {
+	    st.best = first;
+        for (int d = 1; d <= maxdepth; d++) {
+            int depth = std::min(d + st.id % 2, maxdepth);
+            st.pvmove = (d > 1) ? st.best : Move();
+            st.canstop = (st.id > 0 || d > 1); // The main thread always finishes depth 1 so there is a move to return
+            
+            // Aspiration -- start narrow around the last score and widen towards whichever side failed until the score lands inside
+            int delta = aspiration;
+            bool narrow = (aspiration > 0 && d > 3 && std::abs(st.score) < SCORE_MATE_BOUND);
+            int alpha = narrow ? st.score - delta : -SCORE_INFINITE;
+            int beta = narrow ? st.score + delta : SCORE_INFINITE;
+            int score;
+            while (true) {
+                score = abprune(st, game, depth, alpha, beta);
+                if (st.stopped) break;
+                if (score > alpha && score < beta) break;
+                
+                delta *= 2;
+                if (delta > aspiration * 64) { // Give up on the window
+                    alpha = -SCORE_INFINITE;
+                    beta = SCORE_INFINITE;
+                }
+                else if (score <= alpha) alpha = std::max(-SCORE_INFINITE, score - delta);
+                else beta = std::min(SCORE_INFINITE, score + delta);
+            }
+            if (st.stopped) break;
+            
+            if (st.pvlength[0] > 0) st.best = st.pv[0][0]; // Empty only when every move loses outright
+            st.line.assign(st.pv[0], st.pv[0] + st.pvlength[0]);
+            st.score = score;
+            st.depth = depth;
+            bool mated = (std::abs(score) >= SCORE_MATE_BOUND && SCORE_MATE - std::abs(score) <= depth); // A forced mate inside the searched depth won't change
+            if (st.id > 0) {
+                if (mated) break;
+                if (shared->stop) break;
+                continue;
+            }
+            if (verbose) std::cout << "DEPTH " << depth << " " << st.best.toString() << " SCORE " << score << " NODES " << shared->nodes.load() << " TIME " << elapsed() << "ms\n";
+            if (onIteration) onIteration(depth, score, st.line);
+            if (mated) break;
+            
+            // Another iteration costs several times the last one so don't start it if it can't finish
+            if (shared->limits.movetime > 0 && elapsed() * 2 >= shared->limits.movetime) break;
+            if (shared->limits.nodes > 0 && shared->nodes * 2 >= shared->limits.nodes) break;
+        }
+	}
+	
+	// Runs iterate() on every thread and returns the best move of the deepest finished iteration (the main thread's on a tie).
+	Move pick(ChessGame game, SearchLimits lim, bool verbose = false) {
+        shared->limits = lim;
+        shared->stop = false;
+        shared->nodes = 0;
+        searchstart = std::chrono::steady_clock::now();
+        
+        MoveList legals;
+        game.generateMoves(legals);
+        if (legals.empty()) return Move();
+        if (!tt) tt = std::make_shared<TranspositionTable>(hashmb);
+        tt->newSearch();
+        initEvalCache();
+        quantize(); // The coefficients may have been changed since the last search
+        
+        int maxdepth = (lim.depth > 0) ? lim.depth : 64;
+        std::vector<std::unique_ptr<SearchThread>> workers;
+        for (int i = 0; i < std::max(threads, 1); i++) {
+            workers.emplace_back(new SearchThread());
+            workers.back()->id = i;
+            workers.back()->rng.reseed(rng.next());
+        }
+        
+        std::vector<std::thread> helpers;
+        for (int i = 1; i < (int)workers.size(); i++) helpers.emplace_back([this, &workers, i, game, &legals, maxdepth]() { iterate(*workers[i], game, legals[0], maxdepth, false); });
+        iterate(*workers[0], game, legals[0], maxdepth, verbose);
+        shared->stop = true;
+        for (auto& t : helpers) t.join();
+        
+        Move best = workers[0]->best;
+        int depth = workers[0]->depth;
+        nodecount = 0;
         leafcount = 0;
-        chosenmove = game.getAllLegalMoves()[0];
-        abprune(game, 2, -1 * DBL_MAX, DBL_MAX, true);
+        for (auto& w : workers) {
+            nodecount += w->nodecount;
+            leafcount += w->leafcount;
+            evalstats.hits += w->evalstats.hits;
+            evalstats.misses += w->evalstats.misses;
+            if (w->depth > depth && !w->best.isNull()) {
+                depth = w->depth;
+                best = w->best;
+            }
+        }
+        
         if (verbose) std::cout << leafcount << " LEAF NODES CHECKED\n";
-        return chosenmove;
+        if (verbose && evalcache) std::cout << "EVAL CACHE " << evalstats.hits << " HITS " << evalstats.misses << " MISSES\n";
+        return best;
 	}
     
     // mob / rbndef / qdef / kmob / kdef / oo / chk / ckmt / movecount
@@ -340,19 +1079,27 @@ class ChessAI {
         std::string res = "MOB " + std::to_string(mob) + " RBN " + std::to_string(rbndef) + " QDEF " + std::to_string(qdef);
         res = res + " KMOB " + std::to_string(kmob) + " KDEF " + std::to_string(kdef) + " OO " + std::to_string(oo);
         res = res + " CHK " + std::to_string(chk) + " CKMT " + std::to_string(ckmt) + " MCNT " + std::to_string(movecount);
+        res = res + " NMR " + std::to_string(nullreduction) + " NMD " + std::to_string(nullmindepth);
+        res = res + " LMRD " + std::to_string(lmrmindepth) + " LMRM " + std::to_string(lmrmoves) + " LMRL " + std::to_string(lmrlate) + " LMRR " + std::to_string(lmrreduction);
         return res;
     }
 };
 
 namespace Genetic {
     
-// Play with a1 white and a2 black
-int test(ChessAI a1, ChessAI a2, bool verbose = false) {
+// Play with a1 white and a2 black. A nonzero seed reseeds both AIs so the game can be replayed; 0 keeps their generators as they are.
+int test(ChessAI a1, ChessAI a2, bool verbose = false, uint64_t seed = 0) {
     ChessGame game;
+    if (seed) {
+        Rng rng(seed);
+        a1.rng.reseed(rng.next());
+        a2.rng.reseed(rng.next());
+        if (verbose) std::cout << "SEED " << seed << "\n";
+    }
     
     while (true) { // a1 white a2 black
-        auto move = game.sidetomove ? (a1.pick(game)) : (a2.pick(game));
-        game.execute(move.first, move.second);
+        Move move = game.sidetomove ? (a1.pick(game)) : (a2.pick(game));
+        game.execute(move);
         game.sidetomove = !game.sidetomove;
         
         if (verbose) std::cout << game.toString() << "\n";
@@ -371,71 +1118,108 @@ int test(ChessAI a1, ChessAI a2, bool verbose = false) {
     }
 }
 
-std::vector<ChessAI> tournament(std::vector<ChessAI> ais, bool verbose = false) {
-    std::random_shuffle(ais.begin(), ais.end());
+// Pairs the AIs up at random and keeps the winner of each game (a coin flip on a draw). Games are spread over a pool of threads.
+// Every game gets its own seed drawn up front from the tournament seed, so the winners only depend on the seed and not on the thread count.
+// A seed of 0 picks a random one.
+std::vector<ChessAI> tournament(std::vector<ChessAI> ais, bool verbose = false, int threads = 1, uint64_t seed = 0) {
+    if (!seed) seed = ((uint64_t)std::random_device()() << 32) | std::random_device()();
+    if (verbose) std::cout << "SEED " << seed << "\n";
+    
+    Rng rng(seed);
+    rng.shuffle(ais.begin(), ais.end());
+    int games = ais.size() / 2;
+    std::vector<uint64_t> seeds(games);
+    for (int i = 0; i < games; i++) seeds[i] = rng.next();
+    
+    std::vector<int> vals(games);
+    std::atomic<int> next(0);
+    std::mutex out;
+    auto worker = [&]() {
+        for (int i = next++; i < games; i = next++) {
+            vals[i] = test(ais[2 * i], ais[2 * i + 1], false, seeds[i]);
+            if (verbose) { // Enough to replay any game with test(white, black, true, seed)
+                std::lock_guard<std::mutex> lock(out);
+                std::cout << "GAME " << i << " SEED " << seeds[i] << " RESULT " << vals[i] << std::endl;
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int i = 1; i < std::min(threads, games); i++) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+    
     std::vector<ChessAI> res;
-    for (int i = 0; i < ais.size() - 1; i += 2) {
-        int val = test(ais[i], ais[i + 1]);
-        if (val > 0) res.push_back(ChessAI(ais[i]));
-        else if (val < 0) res.push_back(ChessAI(ais[i + 1]));
+    for (int i = 0; i < games; i++) {
+        if (vals[i] > 0) res.push_back(ChessAI(ais[2 * i]));
+        else if (vals[i] < 0) res.push_back(ChessAI(ais[2 * i + 1]));
         else {
-            if (rand() % 2 == 0) res.push_back(ChessAI(ais[i]));
-            else res.push_back(ChessAI(ais[i + 1]));
+            if (rng.coin()) res.push_back(ChessAI(ais[2 * i]));
+            else res.push_back(ChessAI(ais[2 * i + 1]));
         }
-        if (verbose) std::cout << "X";
     }
-    if (verbose) std::cout << "\n";
     return res;
 }
 
-// mob / rbndef / qdef / kmob / kdef / oo / chk / ckmt / movecount
+// mob / rbndef / qdef / kmob / kdef / oo / chk / ckmt / movecount, then the null move and LMR search parameters
 
-ChessAI cross(ChessAI a1, ChessAI a2) {
+ChessAI cross(ChessAI a1, ChessAI a2, Rng& rng) {
     ChessAI res(a1);
-    if (rand() % 2 == 0) res.mob = a2.mob;
-    if (rand() % 2 == 0) res.rbndef = a2.rbndef;
-    if (rand() % 2 == 0) res.qdef = a2.qdef;
-    if (rand() % 2 == 0) res.kmob = a2.kmob;
-    if (rand() % 2 == 0) res.kdef = a2.kdef;
-    if (rand() % 2 == 0) res.oo = a2.oo;
-    if (rand() % 2 == 0) res.chk = a2.chk;
-    if (rand() % 2 == 0) res.ckmt = a2.ckmt;
-    if (rand() % 2 == 0) res.movecount = a2.movecount;
+    if (rng.coin()) res.mob = a2.mob;
+    if (rng.coin()) res.rbndef = a2.rbndef;
+    if (rng.coin()) res.qdef = a2.qdef;
+    if (rng.coin()) res.kmob = a2.kmob;
+    if (rng.coin()) res.kdef = a2.kdef;
+    if (rng.coin()) res.oo = a2.oo;
+    if (rng.coin()) res.chk = a2.chk;
+    if (rng.coin()) res.ckmt = a2.ckmt;
+    if (rng.coin()) res.movecount = a2.movecount;
+    if (rng.coin()) res.nullreduction = a2.nullreduction;
+    if (rng.coin()) res.nullmindepth = a2.nullmindepth;
+    if (rng.coin()) res.lmrmindepth = a2.lmrmindepth;
+    if (rng.coin()) res.lmrmoves = a2.lmrmoves;
+    if (rng.coin()) res.lmrlate = a2.lmrlate;
+    if (rng.coin()) res.lmrreduction = a2.lmrreduction;
     return res;
 }
 
-double randf() {
-    return (double)(rand()) / RAND_MAX;
+double randf(Rng& rng) {
+    return rng.uniform();
 }
 
-// mob / rbndef / qdef / kmob / kdef / oo / chk / ckmt / movecount
+// mob / rbndef / qdef / kmob / kdef / oo / chk / ckmt / movecount, then the null move and LMR search parameters
 
-ChessAI mutate(ChessAI ai) {
+ChessAI mutate(ChessAI ai, Rng& rng) {
     ChessAI res(ai);
-    int beep = rand() % 64;
-    if (beep == 0) res.mob = randf() * 4 - 2;
-    if (beep == 1) res.rbndef = randf() * 4 - 2;
-    if (beep == 2) res.qdef = randf() * 4 - 2;
-    if (beep == 3) res.kmob = randf() * 4 - 2;
-    if (beep == 4) res.kdef = randf() * -4 + 2;
-    if (beep == 5) res.oo = randf() * 4 - 2;
-    if (beep == 6) res.chk = randf() * 4 - 2;
-    // if (beep == 7) res.ckmt = randf() * 400;
-    if (beep == 8) res.movecount = (0.5 - randf()) * 0.5;
+    int beep = rng.below(64);
+    if (beep == 0) res.mob = randf(rng) * 4 - 2;
+    if (beep == 1) res.rbndef = randf(rng) * 4 - 2;
+    if (beep == 2) res.qdef = randf(rng) * 4 - 2;
+    if (beep == 3) res.kmob = randf(rng) * 4 - 2;
+    if (beep == 4) res.kdef = randf(rng) * -4 + 2;
+    if (beep == 5) res.oo = randf(rng) * 4 - 2;
+    if (beep == 6) res.chk = randf(rng) * 4 - 2;
+    // if (beep == 7) res.ckmt = randf(rng) * 400;
+    if (beep == 8) res.movecount = (0.5 - randf(rng)) * 0.5;
+    if (beep == 9) res.nullreduction = 1 + rng.below(3);
+    if (beep == 10) res.nullmindepth = 2 + rng.below(3);
+    if (beep == 11) res.lmrmindepth = 2 + rng.below(3);
+    if (beep == 12) res.lmrmoves = 1 + rng.below(6);
+    if (beep == 13) res.lmrlate = res.lmrmoves + rng.below(16);
+    if (beep == 14) res.lmrreduction = rng.below(3);
     return res;
 }
 
-ChessAI randomAI() {
+ChessAI randomAI(Rng& rng) {
     ChessAI res;
-    res.mob = randf() * 4 - 2;
-    res.rbndef = randf() * 4 - 2;
-    res.qdef = randf() * 4 - 2;
-    res.kmob = randf() * 4 - 2;
-    res.kdef = randf() * -4 + 2;
-    res.oo = randf() * 4 - 2;
-    res.chk = randf() * 4 - 2;
-    // if (beep == 7) res.ckmt = randf() * 400;
-    res.movecount = (0.5 - randf()) * 0.5;
+    res.mob = randf(rng) * 4 - 2;
+    res.rbndef = randf(rng) * 4 - 2;
+    res.qdef = randf(rng) * 4 - 2;
+    res.kmob = randf(rng) * 4 - 2;
+    res.kdef = randf(rng) * -4 + 2;
+    res.oo = randf(rng) * 4 - 2;
+    res.chk = randf(rng) * 4 - 2;
+    // if (beep == 7) res.ckmt = randf(rng) * 400;
+    res.movecount = (0.5 - randf(rng)) * 0.5;
     return res;
 }
 
@@ -17,7 +17,9 @@ void scoretable() {
 // Example thing to run tournaments on engines. This instance runs one trained model on randomly generated models.
 
 int main() {
-    srand(time(0));
+    uint64_t seed = ((uint64_t)std::random_device()() << 32) | std::random_device()();
+    std::cout << "SEED " << seed << "\n"; // Every game below is seeded from this one
+    Rng rng(seed);
 
 
 
@@ -29,7 +31,8 @@ int main() {
 
     std::cout << "AS WHITE\n";
 	for (int i = 0; i < 128; i++) {
-        int val = Genetic::test(res, Genetic::randomAI());
+        ChessAI opp = Genetic::randomAI(rng);
+        int val = Genetic::test(res, opp, false, rng.next());
         if (val > 0) wb++;
         if (val < 0) bb++;
         if (val == 0) dr++;
@@ -44,7 +47,8 @@ int main() {
 
 	std::cout << "AS BLACK\n";
 	for (int i = 0; i < 128; i++) {
-        int val = Genetic::test(Genetic::randomAI(), res);
+        ChessAI opp = Genetic::randomAI(rng);
+        int val = Genetic::test(opp, res, false, rng.next());
         if (val > 0) wb++;
         if (val < 0) bb++;
         if (val == 0) dr++;
@@ -59,7 +63,7 @@ int main() {
     std::cout << "PLAYING AGAINST SELF\n";
 
 	for (int i = 0; i < 128; i++) {
-        int val = Genetic::test(res, res);
+        int val = Genetic::test(res, res, false, rng.next());
         if (val > 0) wb++;
         if (val < 0) bb++;
         if (val == 0) dr++;
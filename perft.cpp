@@ -0,0 +1,135 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include "chess.h"
+#include "genetic.h"
+
+// Move generator correctness check and benchmark. Counts the leaf nodes of the legal move tree to a fixed depth.
+//
+// ./perft                      runs the standard reference positions and compares against the known counts
+// ./perft suite 5              same but goes up to depth 5 where the reference has it (default 4)
+// ./perft 4                    divide from the starting position -- nodes under each root move, then the total
+// ./perft 3 <FEN>              divide from any position given as FEN
+// ./perft pv 6                 searches the reference positions twice (the second time with a warm transposition table)
+//                              and checks every iteration reports a principal variation as long as its depth
+
+struct PerftCase {
+    std::string name;
+    std::string fen;
+    std::vector<long long> counts; // counts[d - 1] is the node count at depth d
+};
+
+// https://www.chessprogramming.org/Perft_Results
+std::vector<PerftCase> reference = {
+    {"startpos", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", {20, 400, 8902, 197281, 4865609, 119060324}},
+    {"kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", {48, 2039, 97862, 4085603, 193690690}},
+    {"position 3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", {14, 191, 2812, 43238, 674624, 11030083}},
+    {"position 4", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", {6, 264, 9467, 422333, 15833292}},
+    {"position 5", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", {44, 1486, 62379, 2103487, 89941194}},
+    {"position 6", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", {46, 2079, 89890, 3894594, 164075551}},
+};
+
+long long perft(ChessGame& game, int depth) {
+    MoveList moves;
+    game.generateMoves(moves);
+    if (depth <= 1) return moves.size(); // Bulk count the last ply
+
+    long long res = 0;
+    for (Move m : moves) {
+        ChessGame::UndoInfo undo = game.makeMove(m);
+        res += perft(game, depth - 1);
+        game.unmakeMove(m, undo);
+    }
+    return res;
+}
+
+double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void divide(ChessGame& game, int depth) {
+    auto start = std::chrono::steady_clock::now();
+    MoveList moves;
+    game.generateMoves(moves);
+
+    long long total = 0;
+    for (Move m : moves) {
+        ChessGame::UndoInfo undo = game.makeMove(m);
+        long long n = (depth > 1) ? perft(game, depth - 1) : 1;
+        game.unmakeMove(m, undo);
+        std::cout << m.toString() << ": " << n << "\n";
+        total += n;
+    }
+
+    double t = seconds(start);
+    std::cout << "\nMOVES " << moves.size() << "\nNODES " << total << "\nTIME " << t << "s\nNPS " << (long long)(total / std::max(t, 1e-9)) << "\n";
+}
+
+int suite(int maxdepth) {
+    int failures = 0;
+    long long nodes = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (auto c : reference) {
+        ChessGame game;
+        game.fromFEN(c.fen);
+        for (int d = 1; d <= maxdepth && d <= (int)c.counts.size(); d++) {
+            auto t0 = std::chrono::steady_clock::now();
+            long long n = perft(game, d);
+            nodes += n;
+            bool ok = (n == c.counts[d - 1]);
+            if (!ok) failures++;
+            std::cout << (ok ? "PASS " : "FAIL ") << c.name << " depth " << d << " " << n;
+            if (!ok) std::cout << " (expected " << c.counts[d - 1] << ")";
+            std::cout << " " << seconds(t0) << "s\n";
+        }
+    }
+
+    double t = seconds(start);
+    std::cout << "\n" << failures << " FAILED\nNODES " << nodes << "\nTIME " << t << "s\nNPS " << (long long)(nodes / std::max(t, 1e-9)) << "\n";
+    return failures ? 1 : 0;
+}
+
+int pvcheck(int maxdepth) {
+    int failures = 0;
+    for (auto c : reference) {
+        ChessGame game;
+        game.fromFEN(c.fen);
+        ChessAI ai;
+        for (int pass = 0; pass < 2; pass++) {
+            ai.onIteration = [&](int depth, int score, const std::vector<Move>& pv) {
+                bool mate = std::abs(score) >= SCORE_MATE_BOUND; // The line ends at the mate
+                bool ok = (int)pv.size() == depth || (mate && (int)pv.size() < depth);
+                if (!ok) failures++;
+                std::cout << (ok ? "PASS " : "FAIL ") << c.name << (pass ? " warm" : " cold") << " depth " << depth << " pv";
+                for (Move m : pv) std::cout << " " << m.toString();
+                std::cout << "\n";
+            };
+            ai.pick(game, SearchLimits(maxdepth));
+        }
+    }
+    std::cout << "\n" << failures << " FAILED\n";
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+    std::string mode = (argc > 1) ? argv[1] : "suite";
+
+    if (mode == "suite") return suite((argc > 2) ? atoi(argv[2]) : 4);
+    if (mode == "pv") return pvcheck((argc > 2) ? atoi(argv[2]) : 6);
+
+    int depth = atoi(argv[1]);
+    std::string fen = reference[0].fen;
+    if (argc > 2) {
+        fen = "";
+        for (int i = 2; i < argc; i++) fen = fen + argv[i] + " ";
+    }
+
+    ChessGame game;
+    if (depth < 1 || !game.fromFEN(fen)) {
+        std::cout << "USAGE: perft [suite [maxdepth]] | perft pv [maxdepth] | perft <depth> [FEN]\n";
+        return 1;
+    }
+    divide(game, depth);
+    return 0;
+}
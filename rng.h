@@ -0,0 +1,76 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+#include <utility>
+
+// Seedable random number generator (xoshiro256**). Each AI, search thread and tournament game owns one,
+// so nothing contends over hidden global state and any run can be replayed from its seed.
+
+struct Rng {
+    typedef uint64_t result_type;
+
+    uint64_t s[4];
+
+    Rng(uint64_t seed = 0) {
+        reseed(seed);
+    }
+
+    // splitmix64 spreads the seed over the whole state so nearby seeds give unrelated streams
+    void reseed(uint64_t seed) {
+        for (int i = 0; i < 4; i++) s[i] = mix(seed);
+    }
+
+    static uint64_t mix(uint64_t& x) {
+        uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    static uint64_t rotl(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    uint64_t next() {
+        uint64_t res = rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return res;
+    }
+
+    // Uniform in [0, n)
+    uint64_t below(uint64_t n) {
+#if defined(__SIZEOF_INT128__)
+        return (uint64_t)(((unsigned __int128)next() * n) >> 64);
+#else
+        return next() % n;
+#endif
+    }
+
+    // Uniform in [0, 1)
+    double uniform() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    bool coin() {
+        return next() >> 63;
+    }
+
+    // Fisher-Yates
+    template <class It> void shuffle(It first, It last) {
+        for (long long i = (long long)(last - first) - 1; i > 0; i--) std::swap(first[i], first[below(i + 1)]);
+    }
+
+    // So it can be handed to <random> and <algorithm>
+    static constexpr uint64_t min() { return 0; }
+    static constexpr uint64_t max() { return ~0ULL; }
+    uint64_t operator()() { return next(); }
+};
+
+#endif
@@ -17,7 +17,9 @@ void scoretable() {
 // Example thing to run tournaments on engines. This instance runs one trained model on randomly generated models.
 
 int main() {
-    srand(time(0));
+    uint64_t seed = ((uint64_t)std::random_device()() << 32) | std::random_device()();
+    std::cout << "SEED " << seed << "\n"; // Every game below is seeded from this one
+    Rng rng(seed);
 
 	ChessAI res(1.902865, 1.453464, 1.325278, 1.929444, -0.434348, -0.908216, 0.230627, 1000.000000, 0.110909); // Example engine
 	ChessAI res1(1.737785, 1.132054, 0.647298, 1.811029, 0.366649, 0.245674, 0.623615, 1000.000000, 0.101665);
@@ -26,7 +28,7 @@ int main() {
     int dr = 0;
 
 	for (int i = 0; i < 16; i++) {
-        int val = Genetic::test(res1, res, false);
+        int val = Genetic::test(res1, res, false, rng.next());
         if (val > 0) wb++;
         if (val < 0) bb++;
         if (val == 0) dr++;
@@ -40,7 +42,7 @@ int main() {
 	dr = 0;
 
 	for (int i = 0; i < 16; i++) {
-        int val = Genetic::test(res, res1, false);
+        int val = Genetic::test(res, res1, false, rng.next());
         if (val > 0) wb++;
         if (val < 0) bb++;
         if (val == 0) dr++;
@@ -1,45 +1,55 @@
 
 #include <iostream>
+#include <string>
+#include <cstdlib>
 #include "chess.h"
 #include "genetic.h"
 
 // Train a chess bot using artificial selection.
+// ./train [--threads N] [--seed S] -- tournament games are played N at a time (default 1). The same seed replays the same run.
 
-int main() {
-    srand(time(0));
+int main(int argc, char** argv) {
+    int threads = 1;
+    uint64_t seed = ((uint64_t)std::random_device()() << 32) | std::random_device()();
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--threads" && i + 1 < argc) threads = std::max(1, atoi(argv[++i]));
+        else if (std::string(argv[i]) == "--seed" && i + 1 < argc) seed = strtoull(argv[++i], nullptr, 10);
+    }
+    std::cout << "SEED " << seed << "\n";
+    Rng rng(seed);
     
     std::vector<ChessAI> v;
     for (int i = 0; i < 32; i++) {
-        ChessAI ai = Genetic::randomAI();
-        v.push_back(Genetic::mutate(ai));
+        ChessAI ai = Genetic::randomAI(rng);
+        v.push_back(Genetic::mutate(ai, rng));
         std::cout << "X";
     }
     std::cout << "\n";
     
     for (int i = 0; i < 32; i++) {
         std::cout << "GEN " << (i + 1) << "\n";
-        std::vector<ChessAI> res = Genetic::tournament(v, true);
+        std::vector<ChessAI> res = Genetic::tournament(v, true, threads, rng.next());
         
         for (auto i : res) std::cout << i.toString() << std::endl;
         
         v.clear();
         for (int round = 0; round < 4; round++) {
-            std::random_shuffle(res.begin(), res.end());
-            for (int i = 0; i < res.size() - 1; i += 2) v.push_back(Genetic::mutate(Genetic::cross(res[i], res[i + 1])));
+            rng.shuffle(res.begin(), res.end());
+            for (int i = 0; i < res.size() - 1; i += 2) v.push_back(Genetic::mutate(Genetic::cross(res[i], res[i + 1], rng), rng));
         }
     }
     
     // Reduction
     std::vector<ChessAI> res;
     while (true) {
-        res = Genetic::tournament(v, true);
+        res = Genetic::tournament(v, true, threads, rng.next());
         if (res.size() <= 1) break;
-        std::random_shuffle(res.begin(), res.end());
+        rng.shuffle(res.begin(), res.end());
     
         v.clear();
         for (int i = 0; i < res.size() - 1; i += 2) {
-            v.push_back(Genetic::mutate(Genetic::cross(res[i], res[i + 1])));
-            v.push_back(Genetic::mutate(Genetic::cross(res[i], res[i + 1])));
+            v.push_back(Genetic::mutate(Genetic::cross(res[i], res[i + 1], rng), rng));
+            v.push_back(Genetic::mutate(Genetic::cross(res[i], res[i + 1], rng), rng));
         }
     }
     
@@ -47,9 +57,9 @@ int main() {
 
 	std::cout << "PLAYING AS WHITE\n";
     
-    for (int i = 0; i < 32; i++) std::cout << Genetic::test(res[0], ChessAI(), false) << " ";
+    for (int i = 0; i < 32; i++) std::cout << Genetic::test(res[0], ChessAI(), false, rng.next()) << " ";
 	std::cout << "\n";
 
 	std::cout << "PLAYING AS BLACK\n";
-    for (int i = 0; i < 32; i++) std::cout << Genetic::test(ChessAI(), res[0], false) << " ";
+    for (int i = 0; i < 32; i++) std::cout << Genetic::test(ChessAI(), res[0], false, rng.next()) << " ";
 }
@@ -0,0 +1,141 @@
+#ifndef TT_H
+#define TT_H
+
+#include <cstdint>
+#include <memory>
+#include <atomic>
+#include <new>
+#include <algorithm>
+#include "chess.h"
+
+// Transposition table -- remembers search results by position key so transposed positions are not searched again.
+// Entries are grouped four to a 64 byte bucket so a probe touches a single cache line.
+// Search threads share one table without locks. Each half of an entry is a relaxed atomic and a torn entry fails the key check.
+
+enum { BOUND_NONE = 0, BOUND_UPPER = 1, BOUND_LOWER = 2, BOUND_EXACT = 3 };
+
+struct TTResult {
+    int score = 0; // Centipawns from the point of view of the side to move in the probed position
+    Move move;
+    int depth = 0;
+    int bound = BOUND_NONE;
+};
+
+struct TTEntry {
+    // meta packs the upper 32 key bits, the move, depth and bound/generation. It is stored XORed with a scrambled data so an entry
+    // whose two halves were written by different stores fails the key check instead of returning a mixed result.
+    std::atomic<uint64_t> check{0};
+    std::atomic<uint64_t> data{0}; // Lower 32 key bits above the score in centipawns
+
+    static uint64_t pack(uint64_t key, Move move, int depth, int bound, int gen) {
+        return (key & 0xFFFFFFFF00000000ULL) | ((uint64_t)move.value << 16) | ((uint64_t)(uint8_t)depth << 8) | (uint64_t)((gen << 2) | bound);
+    }
+    
+    // Any change to data flips about half the bits of check, the upper key bits included
+    static uint64_t scramble(uint64_t data) {
+        data = (data ^ (data >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        data = (data ^ (data >> 27)) * 0x94D049BB133111EBULL;
+        return data ^ (data >> 31);
+    }
+};
+
+struct alignas(64) TTBucket {
+    TTEntry entries[4];
+};
+
+class TranspositionTable {
+    public:
+
+    TranspositionTable(size_t mb = 16) {
+        resize(mb);
+    }
+
+    // Sized in megabytes, rounded down to a power of two number of buckets
+    void resize(size_t mb) {
+        size_t count = 1;
+        while (count * 2 * sizeof(TTBucket) <= mb * 1024 * 1024) count *= 2;
+        memory.reset(new char[count * sizeof(TTBucket) + 64]);
+        buckets = (TTBucket*)(((uintptr_t)memory.get() + 63) & ~(uintptr_t)63);
+        for (size_t i = 0; i < count; i++) new (&buckets[i]) TTBucket();
+        mask = count - 1;
+        generation = 0;
+    }
+
+    void clear() {
+        for (size_t i = 0; i <= mask; i++) {
+            for (int j = 0; j < 4; j++) {
+                buckets[i].entries[j].check.store(0, std::memory_order_relaxed);
+                buckets[i].entries[j].data.store(0, std::memory_order_relaxed);
+            }
+        }
+        generation = 0;
+    }
+
+    // Call once per search so entries from older searches are replaced first
+    void newSearch() {
+        generation = (generation + 1) & 63;
+    }
+
+    bool probe(uint64_t key, TTResult& res) {
+        TTBucket& b = buckets[key & mask];
+        for (int i = 0; i < 4; i++) {
+            uint64_t data = b.entries[i].data.load(std::memory_order_relaxed);
+            uint64_t meta = b.entries[i].check.load(std::memory_order_relaxed) ^ TTEntry::scramble(data);
+            if ((meta >> 32) != (key >> 32) || (data >> 32) != (key & 0xFFFFFFFFULL) || (meta & 3) == BOUND_NONE) continue;
+
+            res.score = (int32_t)(uint32_t)data;
+            res.move.value = (meta >> 16) & 0xFFFF;
+            res.depth = (int8_t)((meta >> 8) & 0xFF);
+            res.bound = meta & 3;
+            return true;
+        }
+        return false;
+    }
+
+    void store(uint64_t key, int score, Move move, int depth, int bound) {
+        TTBucket& b = buckets[key & mask];
+
+        // Reuse the slot holding this position, otherwise evict the shallowest entry, counting older searches as shallower.
+        int slot = 0;
+        int worst = 1 << 30;
+        for (int i = 0; i < 4; i++) {
+            uint64_t data = b.entries[i].data.load(std::memory_order_relaxed);
+            uint64_t meta = b.entries[i].check.load(std::memory_order_relaxed) ^ TTEntry::scramble(data);
+            if ((meta >> 32) == (key >> 32) && (data >> 32) == (key & 0xFFFFFFFFULL) && (meta & 3) != BOUND_NONE) {
+                slot = i;
+                if (move.isNull()) move.value = (meta >> 16) & 0xFFFF; // Keep the old best move
+                break;
+            }
+            int age = (generation - (int)((meta >> 2) & 63)) & 63;
+            int value = ((meta & 3) == BOUND_NONE) ? -(1 << 20) : (int8_t)((meta >> 8) & 0xFF) - 8 * age;
+            if (value < worst) {
+                worst = value;
+                slot = i;
+            }
+        }
+
+        uint64_t data = (key << 32) | (uint32_t)score;
+        b.entries[slot].data.store(data, std::memory_order_relaxed);
+        b.entries[slot].check.store(TTEntry::pack(key, move, depth, bound, generation) ^ TTEntry::scramble(data), std::memory_order_relaxed);
+    }
+
+    // Permille of sampled entries written during the current search
+    int hashfull() {
+        int res = 0;
+        for (size_t i = 0; i < 250 && i <= mask; i++) {
+            for (int j = 0; j < 4; j++) {
+                uint64_t meta = buckets[i].entries[j].check.load(std::memory_order_relaxed) ^ TTEntry::scramble(buckets[i].entries[j].data.load(std::memory_order_relaxed));
+                if ((meta & 3) != BOUND_NONE && (int)((meta >> 2) & 63) == generation) res++;
+            }
+        }
+        return res * 1000 / (4 * std::min((size_t)250, mask + 1));
+    }
+
+    private:
+    std::unique_ptr<char[]> memory;
+    TTBucket* buckets = nullptr;
+    size_t mask = 0;
+    int generation = 0;
+};
+
+#endif
@@ -0,0 +1,191 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include "chess.h"
+#include "genetic.h"
+
+// Universal Chess Interface front-end so the engine can be run from a GUI or tournament manager (g++ -O2 -pthread uci.cpp -o uci).
+//
+// position startpos|fen <FEN> [moves e2e4 ...]
+// go [depth N] [movetime MS] [nodes N] [wtime MS] [btime MS] [winc MS] [binc MS] [movestogo N] [infinite]
+// stop / isready / ucinewgame / quit
+// setoption name Hash|Threads|<coefficient> value X -- the coefficients are the nine ChessAI evaluation weights
+
+ChessAI ai;
+ChessGame game;
+std::thread searcher;
+std::atomic<bool> searching(false);
+std::atomic<bool> infinite(false); // go infinite -- bestmove waits for stop even if the search runs out first
+std::mutex out;
+
+void send(std::string line) {
+    std::lock_guard<std::mutex> lock(out);
+    std::cout << line << std::endl;
+}
+
+// Coefficient options, in the same order as ChessAI::toString()
+struct Coefficient {
+    std::string name;
+    double ChessAI::* field;
+};
+
+std::vector<Coefficient> coefficients = {
+    {"Mob", &ChessAI::mob}, {"RbnDef", &ChessAI::rbndef}, {"QDef", &ChessAI::qdef},
+    {"KMob", &ChessAI::kmob}, {"KDef", &ChessAI::kdef}, {"OO", &ChessAI::oo},
+    {"Chk", &ChessAI::chk}, {"Ckmt", &ChessAI::ckmt}, {"MoveCount", &ChessAI::movecount},
+};
+
+// Scores are centipawns from the side to move's view. Mates are reported in moves, negative when the engine is getting mated.
+std::string scoreString(int score) {
+    if (score >= SCORE_MATE_BOUND) return "mate " + std::to_string((SCORE_MATE - score + 1) / 2);
+    if (score <= -SCORE_MATE_BOUND) return "mate " + std::to_string(-(SCORE_MATE + score) / 2);
+    return "cp " + std::to_string(score);
+}
+
+void waitForSearch() {
+    while (searching) { // Keep asking in case the search had not started listening yet
+        infinite = false;
+        ai.stop();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (searcher.joinable()) searcher.join();
+}
+
+void position(std::istringstream& in) {
+    std::string token;
+    in >> token;
+    if (token == "startpos") {
+        game = ChessGame();
+        in >> token;
+    }
+    else if (token == "fen") {
+        std::string fen = "";
+        while (in >> token && token != "moves") fen = fen + token + " ";
+        if (!game.fromFEN(fen)) {
+            send("info string bad fen " + fen);
+            return;
+        }
+    }
+    if (token != "moves") return;
+
+    while (in >> token) {
+        MoveList legals;
+        game.generateMoves(legals);
+        bool found = false;
+        for (Move m : legals) {
+            if (m.toString() != token) continue;
+            game.makeMove(m);
+            found = true;
+            break;
+        }
+        if (!found) {
+            send("info string illegal move " + token);
+            return;
+        }
+    }
+}
+
+void go(std::istringstream& in) {
+    SearchLimits lim(0);
+    infinite = false;
+    long long wtime = -1, btime = -1, winc = 0, binc = 0, movestogo = 30;
+    std::string token;
+    while (in >> token) {
+        if (token == "depth") in >> lim.depth;
+        else if (token == "movetime") in >> lim.movetime;
+        else if (token == "nodes") in >> lim.nodes;
+        else if (token == "wtime") in >> wtime;
+        else if (token == "btime") in >> btime;
+        else if (token == "winc") in >> winc;
+        else if (token == "binc") in >> binc;
+        else if (token == "movestogo") in >> movestogo;
+        else if (token == "infinite") infinite = true;
+    }
+
+    // Clock time -- spend an even share of what is left plus most of the increment, and never risk the flag.
+    long long left = game.sidetomove ? wtime : btime;
+    long long inc = game.sidetomove ? winc : binc;
+    if (left >= 0 && lim.movetime == 0) {
+        double budget = (double)left / std::max(1LL, movestogo) + inc * 0.75;
+        lim.movetime = std::max(1.0, std::min(budget, left * 0.5));
+    }
+
+    searching = true;
+    searcher = std::thread([lim]() {
+        Move best = ai.pick(game, lim);
+        while (infinite) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        send("bestmove " + best.toString());
+        searching = false;
+    });
+}
+
+void setoption(std::istringstream& in) {
+    std::string token, name, value;
+    in >> token; // name
+    while (in >> token && token != "value") name = name + (name.empty() ? "" : " ") + token;
+    in >> value;
+
+    if (name == "Hash") ai.setHash(std::max(1, atoi(value.c_str())));
+    else if (name == "Threads") ai.threads = std::max(1, atoi(value.c_str()));
+    else {
+        for (auto c : coefficients) {
+            if (c.name == name) ai.*c.field = atof(value.c_str());
+        }
+    }
+}
+
+int main() {
+    ai.setHash(16);
+    ai.onIteration = [](int depth, int score, const std::vector<Move>& pv) {
+        double ms = ai.elapsed();
+        long long nodes = ai.shared->nodes;
+        std::string line = "info depth " + std::to_string(depth) + " score " + scoreString(score) + " nodes " + std::to_string(nodes);
+        line = line + " nps " + std::to_string((long long)(nodes * 1000 / std::max(ms, 1.0))) + " time " + std::to_string((long long)ms);
+        line = line + " hashfull " + std::to_string(ai.tt->hashfull()) + " pv";
+        for (Move m : pv) line = line + " " + m.toString();
+        send(line);
+    };
+
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        std::istringstream in(line);
+        std::string cmd;
+        in >> cmd;
+
+        if (cmd == "uci") {
+            std::string res = "id name CHESS\nid author WW92030\n";
+            res = res + "option name Hash type spin default 16 min 1 max 65536\n";
+            res = res + "option name Threads type spin default 1 min 1 max 512\n";
+            ChessAI defaults;
+            for (auto c : coefficients) res = res + "option name " + c.name + " type string default " + std::to_string(defaults.*c.field) + "\n";
+            send(res + "uciok");
+        }
+        else if (cmd == "isready") send("readyok");
+        else if (cmd == "ucinewgame") {
+            waitForSearch();
+            game = ChessGame();
+            if (ai.tt) ai.tt->clear();
+        }
+        else if (cmd == "position") {
+            waitForSearch();
+            position(in);
+        }
+        else if (cmd == "go") {
+            waitForSearch();
+            go(in);
+        }
+        else if (cmd == "stop") waitForSearch();
+        else if (cmd == "setoption") {
+            waitForSearch();
+            setoption(in);
+        }
+        else if (cmd == "d") send(game.toString() + game.toFEN());
+        else if (cmd == "quit") break;
+    }
+
+    waitForSearch();
+    return 0;
+}
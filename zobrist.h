@@ -0,0 +1,51 @@
+#ifndef ZOBRIST_H
+#define ZOBRIST_H
+
+#include <cstdint>
+#include "bitboard.h"
+
+// Zobrist hashing -- a position's key is the XOR of one random number per (piece, square), castling right, en passant file and side to move.
+// Making a move only has to XOR out what changed and XOR in the new state.
+
+namespace Zobrist {
+
+struct Keys {
+    uint64_t piece[12][64]; // [WHITE PAWN ... WHITE KING, BLACK PAWN ... BLACK KING][square]
+    uint64_t castle[4]; // WHITE QUEENSIDE, WHITE KINGSIDE, BLACK QUEENSIDE, BLACK KINGSIDE
+    uint64_t ep[16]; // [0, 8) WHITE just double pushed on that file, [8, 16) BLACK did
+    uint64_t side; // Folded in when BLACK is to move
+
+    Keys() {
+        uint64_t s = 0x2545F4914F6CDD1DULL; // Fixed seed so keys are the same across runs and builds
+        for (int i = 0; i < 12; i++) {
+            for (int sq = 0; sq < 64; sq++) piece[i][sq] = next(s);
+        }
+        for (int i = 0; i < 4; i++) castle[i] = next(s);
+        for (int i = 0; i < 16; i++) ep[i] = next(s);
+        side = next(s);
+    }
+
+    static uint64_t next(uint64_t& s) { // splitmix64
+        uint64_t z = (s += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+};
+
+inline const Keys& keys() {
+    static const Keys k;
+    return k;
+}
+
+// Key for a ChessPiece value on a square (0 for an empty square).
+inline uint64_t piece(char value, int sq) {
+    unsigned char v = value;
+    if (!(v & 0xFC)) return 0;
+    int id = Bitboards::lsb(v & 0xFC);
+    return keys().piece[((v & (1<<1)) ? 6 : 0) + id - 2][sq];
+}
+
+}
+
+#endif